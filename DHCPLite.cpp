@@ -3,105 +3,489 @@
 // Retrieved from Github: https://github.com/pkulchenko/DHCPLite/tree/master
 
 #include "DHCPLite.h"
-#include "dhcpserver.h"
+#include "dhcpleasestore.h"
 
-extern DHCPServer dhcpServer;
-
-byte quads[4];
-byte* long2quad(unsigned long value) {
+static byte* long2quad(unsigned long value, byte* quads) {
   for (int k = 0; k < 4; k++) quads[3 - k] = value >> (k * 8);
   return quads;
 }
 
-int getOption(int dhcpOption, byte* options, int optionSize, int* optionLength) {
-  for (int i = 0; i < optionSize && (options[i] != dhcpEndOption); i += 2 + options[i + 1]) {
-    if (options[i] == dhcpOption) {
-      if (optionLength) *optionLength = (int) options[i + 1];
-      return i + 2;
-    }
-  }
-  if (optionLength) *optionLength = 0;
-  return 0;
-}
-
-int populatePacket(byte* packet, int currLoc, byte marker, byte* what, int dataSize) {
+static int populatePacket(byte* packet, int currLoc, byte marker, const byte* what, int dataSize) {
   packet[currLoc] = marker;
   packet[currLoc + 1] = dataSize;
   memcpy(packet + currLoc + 2, what, dataSize);
   return dataSize + 2;
 }
 
-int DHCPreply(RIP_MSG* packet, int packetSize, byte* serverIP, const char* domainName) {
-  if (packet->op != DHCP_BOOTREQUEST) return 0; // limited check that we're dealing with DHCP/BOOTP request
-  byte OPToffset = (byte*) packet->OPT - (byte*) packet;
+// RFC 4702 reply: S says whether this server updates the A record, O that it went against what the client
+// asked for, and N is echoed. The name goes back in the encoding the client used.
+static int populateFQDN(byte* packet, int currLoc, byte clientFlags, const char* host, const char* domain,
+                        bool updating) {
+  int start = currLoc;
+  byte flags = clientFlags & DHCP_FQDN_E;
+  if (clientFlags & DHCP_FQDN_N)
+    flags |= DHCP_FQDN_N;
+  else if (updating)
+    flags |= DHCP_FQDN_S | ((clientFlags & DHCP_FQDN_S) ? 0 : DHCP_FQDN_O);
+  else if (clientFlags & DHCP_FQDN_S)
+    flags |= DHCP_FQDN_O;
+
+  packet[currLoc++] = dhcpClientFQDN;
+  packet[currLoc++] = 0; // length, filled in below
+  packet[currLoc++] = flags;
+  packet[currLoc++] = 255; // RCODE1 and RCODE2 are deprecated
+  packet[currLoc++] = 255;
+  int hostLength = strlen(host);
+  if (hostLength && (flags & DHCP_FQDN_E)) {
+    packet[currLoc++] = hostLength;
+    memcpy(packet + currLoc, host, hostLength);
+    currLoc += hostLength;
+    while (domain && *domain) {
+      const char* dot = strchr(domain, '.');
+      int length = (dot) ? dot - domain : (int) strlen(domain);
+      packet[currLoc++] = length;
+      memcpy(packet + currLoc, domain, length);
+      currLoc += length;
+      domain += length + ((dot) ? 1 : 0);
+    }
+    packet[currLoc++] = 0;
+  } else if (hostLength) {
+    memcpy(packet + currLoc, host, hostLength);
+    currLoc += hostLength;
+    if (domain && *domain) {
+      packet[currLoc++] = '.';
+      memcpy(packet + currLoc, domain, strlen(domain));
+      currLoc += strlen(domain);
+    }
+  }
+  packet[start + 1] = currLoc - start - 2;
+  return currLoc - start;
+}
+
+static const byte legacyFields[DHCP_LEGACY_SIZE] = {0}; // sname and file outside of network boot
+
+// One pass over the options, recording where each one's value starts, so every later lookup is a table
+// read. Only the first copy of an option counts; one that runs past the end of the packet ends the scan.
+void DHCPEngine::indexOptions(const byte* options, int size) {
+  memset(optionAt, 0, sizeof(optionAt));
+  int i = 0;
+  while ((i < size) && (options[i] != dhcpEndOption)) {
+    if (options[i] == dhcpPadOption) {
+      i++;
+      continue;
+    }
+    if ((i + 2 > size) || (i + 2 + options[i + 1] > size)) break;
+    if (optionAt[options[i]] == 0) {
+      optionAt[options[i]] = i + 2;
+      optionLength[options[i]] = options[i + 1];
+    }
+    i += 2 + options[i + 1];
+  }
+}
+
+// Offset of the option's value in OPT, or 0 when the client did not send it
+int DHCPEngine::option(byte code, int* length) {
+  if (length) *length = (optionAt[code]) ? optionLength[code] : 0;
+  return optionAt[code];
+}
+
+const byte* DHCPEngine::getConstantOptions(unsigned long leaseTime) {
+  const byte* serverIP = config->serverIP;
+  if (constantValid && (constantLeaseTime == leaseTime) && (memcmp(constantServerIP, serverIP, 4) == 0)) return constantOptions;
+
+  byte quads[4];
+  int currLoc = 0;
+  // iPod with iOS 4 doesn't want to process DHCP OFFER if dhcpServerIdentifier does not follow dhcpMessageType
+  // Windows Vista and Ubuntu 11.04 don't seem to care
+  currLoc += populatePacket(constantOptions, currLoc, dhcpServerIdentifier, serverIP, 4);
 
+  // DHCP lease timers: http://www.tcpipguide.com/free/t_DHCPLeaseLifeCycleOverviewAllocationReallocationRe.htm
+  // Renewal Timer (T1): This timer is set by default to 50% of the lease period.
+  // Rebinding Timer (T2): This timer is set by default to 87.5% of the length of the lease.
+  currLoc += populatePacket(constantOptions, currLoc, dhcpIPaddrLeaseTime, long2quad(leaseTime, quads), 4);
+  currLoc += populatePacket(constantOptions, currLoc, dhcpT1value, long2quad(leaseTime * 0.5, quads), 4);
+  currLoc += populatePacket(constantOptions, currLoc, dhcpT2value, long2quad(leaseTime * 0.875, quads), 4);
+
+  memcpy(constantServerIP, serverIP, 4);
+  constantLeaseTime = leaseTime;
+  constantValid = true;
+  return constantOptions;
+}
+
+// RFC 2131 section 4.1: relayed messages go back to the relay on the server port, NAKs are broadcast,
+// clients with a working address (RENEWING/REBINDING/INFORM) are unicast, and everyone else gets a
+// broadcast. Unicasting to yiaddr before the client has its address needs the reply sent to chaddr
+// without ARP, which the W5500 cannot do, so those are broadcast as well.
+void DHCPEngine::selectDestination(RIP_MSG* packet, byte response, DHCPReply* reply) {
+  reply->broadcast = true;
+  reply->port = DHCP_CLIENT_PORT;
+  if (!zeroAddress(packet->giaddr)) {
+    reply->broadcast = false;
+    memcpy(reply->destination, packet->giaddr, 4);
+    reply->port = DHCP_SERVER_PORT;
+    if (response == DHCP_NAK) packet->flags |= htons(DHCP_FLAG_BROADCAST); // relay must broadcast a NAK
+  } else if ((response != DHCP_NAK) && !zeroAddress(packet->ciaddr) &&
+             !(ntohs(packet->flags) & DHCP_FLAG_BROADCAST)) {
+    reply->broadcast = false;
+    memcpy(reply->destination, packet->ciaddr, 4);
+  }
+}
+
+// RFC 4388: who holds an address, asked by address (ciaddr), by client identifier (option 61) or by hardware
+// address (chaddr), answered from the lease table indexes without a scan. Only an address in one of our
+// pools can be LEASEUNASSIGNED; anything else without an active binding is LEASEUNKNOWN. The reply goes
+// to the requester in giaddr, which has to be a trusted one.
+int DHCPEngine::leaseQuery(RIP_MSG* packet, int packetSize, DHCPReply* reply) {
+  if (!leases->queryRequesterTrusted(packet->giaddr)) {
+    leases->getDropStats()->untrustedQuery++;
+    return 0;
+  }
+  int clientIdLength;
+  int clientIdOffset = option(dhcpClientIdentifier, &clientIdLength);
+  byte clientId[DHCP_CLIENT_ID_SIZE];
+  if (clientIdLength > DHCP_CLIENT_ID_SIZE) clientIdLength = 0;
+  memcpy(clientId, packet->OPT + clientIdOffset, clientIdLength); // the options are rewritten below
+
+  byte lease = INVALID_LEASE;
+  byte response = DHCP_LEASEUNKNOWN;
+  if (!zeroAddress(packet->ciaddr)) {
+    lease = leases->getLeaseByIPAddress(packet->ciaddr);
+    if (leases->getLeasePool(lease) != INVALID_POOL) response = DHCP_LEASEUNASSIGNED; // reserved ones are not
+  } else if (clientIdOffset && clientIdLength)
+    lease = leases->getLeaseByClientId(leases->clientIdHash(clientId, clientIdLength));
+  else if (packet->hlen == DHCP_HLEN_ETHERNET)
+    lease = leases->getLeaseByMAC(packet->chaddr);
+
+  long currTime = millis();
+  bool active = leases->validLease(lease) && (leases->getLeaseStatus(lease) == DHCP_LEASE_ACK) &&
+                !leases->getLeaseExpired(lease, currTime);
+  byte quads[4];
+  int currLoc = 0;
+  if (active) {
+    response = DHCP_LEASEACTIVE;
+    leases->getLeaseIPAddress(lease, packet->ciaddr);
+    packet->htype = DHCP_HTYPE_ETHERNET;
+    packet->hlen = DHCP_HLEN_ETHERNET;
+    memset(packet->chaddr, 0, sizeof(packet->chaddr));
+    memcpy(packet->chaddr, leases->getLeaseMACAddress(lease), DHCP_HLEN_ETHERNET);
+  }
   packet->op = DHCP_BOOTREPLY;
-  packet->secs = 0; // some of the secs come malformed; don't want to send them back
+  packet->secs = 0;
+  packet->OPT[currLoc++] = dhcpMessageType;
+  packet->OPT[currLoc++] = 1;
+  packet->OPT[currLoc++] = response;
+  currLoc += populatePacket(packet->OPT, currLoc, dhcpServerIdentifier, config->serverIP, 4);
+  if (active) {
+    // time left on the lease, and time since the client last bound it
+    unsigned long remaining = leases->getLeaseExpiresSec(lease, currTime);
+    unsigned long leaseTime = leases->getPoolLeaseTime(leases->getLeasePool(lease));
+    currLoc += populatePacket(packet->OPT, currLoc, dhcpIPaddrLeaseTime, long2quad(remaining, quads), 4);
+    currLoc += populatePacket(packet->OPT, currLoc, dhcpClientLastTransactionTime,
+                              long2quad((leaseTime > remaining) ? leaseTime - remaining : 0, quads), 4);
+  }
+  if (clientIdOffset && clientIdLength)
+    currLoc += populatePacket(packet->OPT, currLoc, dhcpClientIdentifier, clientId, clientIdLength);
+  packet->OPT[currLoc++] = dhcpEndOption;
+
+  reply->add((const byte*) packet, DHCP_HEADER_SIZE);
+  reply->add(legacyFields, DHCP_LEGACY_SIZE);
+  reply->add(packet->magic, sizeof(packet->magic) + currLoc);
+  selectDestination(packet, response, reply);
+  return reply->length;
+}
+
+int DHCPEngine::DHCPreply(RIP_MSG* packet, int packetSize, DHCPReply* reply) {
+  const char* domainName = config->domainName;
+  byte quads[4];
 
-  int dhcpMessageOffset = getOption(dhcpMessageType, packet->OPT, packetSize - OPToffset, NULL);
+  reply->segments = 0;
+  reply->length = 0;
+  if (packet->op != DHCP_BOOTREQUEST) return 0; // limited check that we're dealing with DHCP/BOOTP request
+  byte OPToffset = (byte*) packet->OPT - (byte*) packet;
+  indexOptions(packet->OPT, packetSize - OPToffset);
+
+  int dhcpMessageOffset = option(dhcpMessageType, NULL);
   byte dhcpMessage = packet->OPT[dhcpMessageOffset];
+  if (dhcpMessage == DHCP_LEASEQUERY) return leaseQuery(packet, packetSize, reply);
+
+  // option 61: a client that identifies itself keeps its binding across hardware address changes
+  int clientIdLength;
+  int clientIdOffset = option(dhcpClientIdentifier, &clientIdLength);
+  unsigned long clientId =
+      (clientIdOffset && clientIdLength) ? leases->clientIdHash(packet->OPT + clientIdOffset, clientIdLength) : 0;
+  byte lease = leases->getLease(packet->chaddr, clientId);
+
+  // option 50: the address from a previous binding (INIT-REBOOT, DISCOVER) or from the OFFER being accepted
+  int requestedLength;
+  int requestedOffset = option(dhcpRequestedIPaddr, &requestedLength);
+  const byte* requested = (requestedOffset && (requestedLength == 4)) ? packet->OPT + requestedOffset : nullptr;
+
+  // RELEASE and DECLINE are never answered
+  if (dhcpMessage == DHCP_RELEASE) {
+    if (leases->validLeaseNumber(lease)) leases->releaseLease(lease);
+    return 0;
+  }
+  if (dhcpMessage == DHCP_DECLINE) {
+    // only the client's own binding can be declined; anything else would let one host evict another
+    if (leases->validLeaseNumber(lease) && (!requested || (leases->getLeaseByIPAddress(requested) == lease)))
+      leases->declineLease(lease);
+    return 0;
+  }
+
+  // pick the pool from the relay that forwarded the request, or the local network when there is none
+  byte subnet = leases->getSubnetForRelay(packet->giaddr);
+  if (subnet == INVALID_SUBNET) return 0; // relayed from a network we don't serve
+  if (leases->validLeaseNumber(lease) && (leases->getLeaseSubnet(lease) != subnet)) {
+    // the client moved to another network; its old binding is useless there
+    if (dhcpMessage == DHCP_DISCOVER) leases->deleteLease(lease);
+    lease = INVALID_LEASE;
+  }
+
+  // within the subnet, the vendor class or MAC OUI may steer the client into a dedicated range. The range
+  // is the client's class, and a bound client keeps the one its binding's pool records for its address.
+  // Network boot follows what this packet matches instead: PXE firmware and the system it loads share a
+  // MAC address and a binding, but only the firmware should be handed a boot file.
+  int vendorLength;
+  int vendorOffset = option(dhcpClassIdentifier, &vendorLength);
+  byte bootPool = leases->selectPool(subnet, packet->chaddr, (vendorOffset) ? packet->OPT + vendorOffset : nullptr,
+                                     vendorLength);
+  byte poolIndex = leases->getLeasePool(lease);
+  if (poolIndex == INVALID_POOL) poolIndex = bootPool;
+
+  // option 82 (RFC 3046): the circuit and remote id the relay adds name the switch port the client is on,
+  // and a configured port overrides the range and the MAC reservation. Only a configured relay is believed;
+  // on the local segment any host could forge the option and take a port's address.
+  int agentLength;
+  int agentOffset = option(dhcpRelayAgentInfo, &agentLength);
+  byte port = (agentOffset && (subnet != LOCAL_SUBNET))
+                  ? leases->getPortByAgentInfo(packet->OPT + agentOffset, agentLength)
+                  : INVALID_PORT;
+  poolIndex = leases->getPortPool(port, subnet, poolIndex);
+  bootPool = leases->getPortPool(port, subnet, bootPool);
+  memcpy(agentInfo, packet->OPT + agentOffset, agentLength); // echoed after the options are rewritten
+
+  // a reservation for this subnet wins over the dynamic pool and never touches the lease table
+  const byte* reserved = leases->getPortAddress(port);
+  if (!reserved) reserved = leases->getReservedAddress(packet->chaddr);
+  if (reserved && !leases->addressInSubnet(subnet, reserved)) reserved = nullptr;
+  if (reserved) {
+    poolIndex = subnet;
+    lease = INVALID_LEASE;
+  }
+
+  // option 81 (RFC 4702) names the client ahead of option 12, and its N flag keeps the name out of DDNS
+  int hostNameLength;
+  int hostNameOffset = option(dhcpHostName, &hostNameLength);
+  int fqdnLength;
+  int fqdnOffset = option(dhcpClientFQDN, &fqdnLength);
+  if (fqdnLength < 3) fqdnOffset = 0;
+  byte fqdnFlags = (fqdnOffset) ? packet->OPT[fqdnOffset] : 0;
+  if (fqdnOffset && (fqdnLength > 3)) {
+    int nameOffset = fqdnOffset + 3;
+    int nameLength = fqdnLength - 3;
+    if (fqdnFlags & DHCP_FQDN_E) { // wire format: the first label is the host
+      nameLength = (packet->OPT[nameOffset] < nameLength) ? packet->OPT[nameOffset] : nameLength - 1;
+      nameOffset++;
+    }
+    if (nameLength > 0) {
+      hostNameOffset = nameOffset;
+      hostNameLength = nameLength;
+    }
+  }
+  bool publishName = !(fqdnFlags & DHCP_FQDN_N);
 
-  byte lease = dhcpServer.getLease(packet->chaddr);
   byte response = DHCP_NAK;
-  if (dhcpMessage == DHCP_DISCOVER) {
-    if (!dhcpServer.validLeaseNumber(lease)) {
-      lease = dhcpServer.getNewLease(); // use existing lease or get a new one
+  bool rapidCommit = false;
+  unsigned long leaseTime = leases->getPoolLeaseTime(poolIndex);
+  // RFC 4039: a DISCOVER carrying Rapid Commit is bound and ACKed straight away when we allow it
+  if (dhcpMessage == DHCP_DISCOVER)
+    rapidCommit = leases->getRapidCommit() && option(dhcpRapidCommit, NULL);
+
+  if (reserved) {
+    if ((dhcpMessage == DHCP_DISCOVER) ||
+        ((dhcpMessage == DHCP_REQUEST) && (!requested || (memcmp(requested, reserved, 4) == 0)))) {
+      response = (dhcpMessage == DHCP_REQUEST || rapidCommit) ? DHCP_ACK : DHCP_OFFER;
+      memcpy(packet->yiaddr, reserved, 4);
     }
-    if (dhcpServer.validLeaseNumber(lease)) {
-      response = DHCP_OFFER;
-      dhcpServer.setLease(lease, packet->chaddr, millis() + 10000, DHCP_LEASE_OFFER); // 10s
+  } else if (dhcpMessage == DHCP_DISCOVER) {
+    // a retransmission while the client's address is being probed; the held DISCOVER answers it
+    if (leases->probingLease(lease)) return 0;
+    bool fresh = !leases->validLeaseNumber(lease);
+    if (!leases->validLeaseNumber(lease) && requested) {
+      // a returning client gets the address it asks for when that address is still free in its pool
+      byte wanted = leases->getLeaseByIPAddress(requested);
+      if (leases->leaseAvailable(wanted) && (leases->getLeasePool(wanted) == poolIndex)) lease = wanted;
+    }
+    if (!leases->validLeaseNumber(lease)) {
+      lease = leases->getNewLease(poolIndex, packet->chaddr); // use existing lease or get a new one
+      // an exhausted range overflows into the subnet's default pool rather than NAKing its clients
+      if (!leases->validLeaseNumber(lease) && (poolIndex != subnet))
+        lease = leases->getNewLease(subnet, packet->chaddr);
+    }
+    if (leases->getLeasePool(lease) != INVALID_POOL) poolIndex = leases->getLeasePool(lease);
+    leaseTime = leases->getPoolLeaseTime(poolIndex);
+    if (fresh && leases->validLeaseNumber(lease) && leases->probeWanted(subnet)) {
+      // RFC 2131 4.4.1: probe an address before it is first handed out. The packet is still untouched, so
+      // the server holds on to it and runs it through here again once the probe is done.
+      leases->setLease(lease, packet->chaddr, millis() + DHCP_PROBE_HOLD, DHCP_LEASE_OFFER, clientId);
+      reply->probe = true;
+      reply->probeLease = lease;
+      return 0;
+    }
+    if (leases->validLeaseNumber(lease)) {
+      if (rapidCommit) {
+        response = DHCP_ACK;
+        leases->setLease(lease, packet->chaddr, millis() + (leaseTime * 1000), DHCP_LEASE_ACK, clientId);
+        if (hostNameOffset)
+          leases->setHostName(lease, (const char*) packet->OPT + hostNameOffset, hostNameLength, publishName);
+      } else {
+        response = DHCP_OFFER;
+        leases->setLease(lease, packet->chaddr, millis() + 10000, DHCP_LEASE_OFFER, clientId); // 10s
+      }
     }
   } else if (dhcpMessage == DHCP_REQUEST) {
-    if (dhcpServer.validLeaseNumber(lease)) {
+    const byte* claimed = (requested) ? requested : ((zeroAddress(packet->ciaddr)) ? nullptr : packet->ciaddr);
+    if (leases->validLeaseNumber(lease)) {
+      // the binding is authoritative; a client claiming any other address is NAKed
+      byte bound[4];
+      leases->getLeaseIPAddress(lease, bound);
+      if (claimed && (memcmp(claimed, bound, 4) != 0)) lease = INVALID_LEASE;
+    } else if (requested && !option(dhcpServerIdentifier, NULL)) {
+      // INIT-REBOOT without a binding: hand the address back if it is still free in the client's pool, NAK
+      // it when it is on the wrong network, and otherwise stay silent since another server may own it
+      byte wanted = leases->getLeaseByIPAddress(requested);
+      if (leases->leaseAvailable(wanted) && (leases->getLeasePool(wanted) == poolIndex))
+        lease = wanted;
+      else if (leases->addressInSubnet(subnet, requested))
+        return 0;
+    }
+    if (leases->validLeaseNumber(lease)) {
       response = DHCP_ACK;
-
-      // find hostname option in the request and store to provide DNS info
-      dhcpServer.setLease(lease, packet->chaddr, millis() + (dhcpServer.getLeaseTime() * 1000),
-                          DHCP_LEASE_ACK); // DHCP_LEASETIME is in seconds
+      if (leases->getLeasePool(lease) != INVALID_POOL) poolIndex = leases->getLeasePool(lease);
+      leaseTime = leases->getPoolLeaseTime(poolIndex);
+      leases->setLease(lease, packet->chaddr, millis() + (leaseTime * 1000),
+                       DHCP_LEASE_ACK, clientId); // DHCP_LEASETIME is in seconds
+      // keep the client's host name to provide DNS info
+      if (hostNameOffset)
+        leases->setHostName(lease, (const char*) packet->OPT + hostNameOffset, hostNameLength, publishName);
     }
   }
 
-  if (dhcpServer.validLeaseNumber(lease)) { // Dynamic IP configuration
-    dhcpServer.getLeaseIPAddress(lease, packet->yiaddr);
+  packet->op = DHCP_BOOTREPLY;
+  packet->secs = 0; // some of the secs come malformed; don't want to send them back
+
+  SubnetConfig pool;
+  leases->getPoolConfig(poolIndex, &pool);
+  if (zeroAddress(pool.router)) memcpy(pool.router, packet->giaddr, 4);
+
+  // network boot: the next server goes in siaddr and the boot file in the legacy file field
+  BootConfig boot;
+  bool netBoot = (response != DHCP_NAK) && leases->getPoolBoot(bootPool, &boot);
+  char bootServer[16];
+  if (netBoot) {
+    memcpy(packet->siaddr, boot.nextServer, 4);
+    memset(bootFields, 0, sizeof(bootFields));
+    memcpy(bootFields + sizeof(packet->sname), boot.bootFile, sizeof(boot.bootFile));
+    snprintf(bootServer, sizeof(bootServer), "%d.%d.%d.%d", boot.nextServer[0], boot.nextServer[1],
+             boot.nextServer[2], boot.nextServer[3]);
   }
 
-  int currLoc = 0;
-  packet->OPT[currLoc++] = dhcpMessageType;
-  packet->OPT[currLoc++] = 1;
-  packet->OPT[currLoc++] = response;
+  if (leases->validLeaseNumber(lease)) { // Dynamic IP configuration
+    leases->getLeaseIPAddress(lease, packet->yiaddr);
+  }
 
   int reqLength;
-  int reqListOffset = getOption(dhcpParamRequest, packet->OPT, packetSize - OPToffset, &reqLength);
-  byte reqList[12];
-  if (reqLength > 12) reqLength = 12;
+  int reqListOffset = option(dhcpParamRequest, &reqLength);
+  byte reqList[DHCP_PARAM_LIST_SIZE];
+  if (reqLength > DHCP_PARAM_LIST_SIZE) reqLength = DHCP_PARAM_LIST_SIZE;
   memcpy(reqList, packet->OPT + reqListOffset, reqLength);
 
-  // iPod with iOS 4 doesn't want to process DHCP OFFER if dhcpServerIdentifier does not follow dhcpMessageType
-  // Windows Vista and Ubuntu 11.04 don't seem to care
-  currLoc += populatePacket(packet->OPT, currLoc, dhcpServerIdentifier, serverIP, 4);
+  // the class profile drops options from the client's list and adds the ones it must get regardless
+  ClassProfile profile;
+  leases->getPoolProfile(poolIndex, &profile);
+  if (profile.omit || profile.send) {
+    int kept = 0;
+    byte listed = 0;
+    for (int i = 0; i < reqLength; i++) {
+      byte bit = DHCPLeaseStore::profileBit(reqList[i]);
+      if (bit & profile.omit) continue;
+      listed |= bit;
+      reqList[kept++] = reqList[i];
+    }
+    for (byte i = 0; (i < PROFILE_OPTIONS) && (kept < DHCP_PARAM_LIST_SIZE); i++)
+      if ((profile.send & ~profile.omit & ~listed) & (1 << i)) reqList[kept++] = DHCPLeaseStore::profileOption(1 << i);
+    reqLength = kept;
+  }
 
-  // DHCP lease timers: http://www.tcpipguide.com/free/t_DHCPLeaseLifeCycleOverviewAllocationReallocationRe.htm
-  // Renewal Timer (T1): This timer is set by default to 50% of the lease period.
-  // Rebinding Timer (T2): This timer is set by default to 87.5% of the length of the lease.
-  currLoc += populatePacket(packet->OPT, currLoc, dhcpIPaddrLeaseTime, long2quad(dhcpServer.getLeaseTime()), 4);
-  currLoc += populatePacket(packet->OPT, currLoc, dhcpT1value, long2quad(dhcpServer.getLeaseTime() * 0.5), 4);
-  currLoc += populatePacket(packet->OPT, currLoc, dhcpT2value, long2quad(dhcpServer.getLeaseTime() * 0.875), 4);
+  // magic cookie and message type stay in place; the constant options are spliced in after them
+  int currLoc = 0;
+  packet->OPT[currLoc++] = dhcpMessageType;
+  packet->OPT[currLoc++] = 1;
+  packet->OPT[currLoc++] = response;
+  int clientLoc = currLoc;
+  if (rapidCommit && (response == DHCP_ACK)) {
+    packet->OPT[currLoc++] = dhcpRapidCommit;
+    packet->OPT[currLoc++] = 0;
+  }
 
+  // every option has to leave room for the end option in the 576 octets a client must accept, the constant
+  // options spliced in included; the request buffer is no larger. Option 82 is set aside first, since the
+  // relay needs it back to deliver the reply at all.
+  int agentRoom = (agentOffset) ? agentLength + 2 : 0;
+  auto fits = [&](int length) {
+    return DHCP_OPTIONS_OFFSET + DHCP_CONSTANT_OPTIONS_SIZE + currLoc + 2 + length + agentRoom + 1 <=
+           DHCP_MESSAGE_SIZE;
+  };
+  byte emitted[DHCP_OPTION_CODES / 8]; // a code the list names twice is answered once
+  memset(emitted, 0, sizeof(emitted));
   for (int i = 0; i < reqLength; i++) {
-    switch (reqList[i]) {
-    case dhcpSubnetMask:
-      currLoc += populatePacket(packet->OPT, currLoc, reqList[i], long2quad(0xFFFF0000UL), 4); // 255.255.255.0
-      break;
-    case dhcpLogServer: currLoc += populatePacket(packet->OPT, currLoc, reqList[i], long2quad(0), 4); break;
-    case dhcpDns:
-    case dhcpRoutersOnSubnet: currLoc += populatePacket(packet->OPT, currLoc, reqList[i], serverIP, 4); break;
+    byte code = reqList[i];
+    if (emitted[code >> 3] & (1 << (code & 7))) continue;
+    emitted[code >> 3] |= 1 << (code & 7);
+    const byte* data = nullptr;
+    int length = 4;
+    switch (code) {
+    case dhcpSubnetMask: data = pool.subnetMask; break;
+    case dhcpLogServer: data = long2quad(0, quads); break;
+    case dhcpDns: data = pool.dns; break;
+    case dhcpRoutersOnSubnet: data = pool.router; break;
     case dhcpDomainName:
-      if (domainName && strlen(domainName))
-        currLoc += populatePacket(packet->OPT, currLoc, reqList[i], (byte*) domainName, strlen(domainName));
+      if (domainName && strlen(domainName)) {
+        data = (const byte*) domainName;
+        length = strlen(domainName);
+      }
+      break;
+    case dhcpTFTPServerName:
+      if (netBoot) {
+        data = (const byte*) bootServer;
+        length = strlen(bootServer);
+      }
+      break;
+    case dhcpBootFileName:
+      if (netBoot) {
+        data = (const byte*) boot.bootFile;
+        length = strnlen(boot.bootFile, sizeof(boot.bootFile));
+      }
       break;
     }
+    if (data && fits(length)) currLoc += populatePacket(packet->OPT, currLoc, code, data, length);
+  }
+  if (fqdnOffset && (response == DHCP_ACK) && leases->validLeaseNumber(lease)) {
+    const char* host = leases->getHostName(lease);
+    // flags, two rcodes, and at most a length byte before the host, one for the domain and a terminator
+    int fqdnLength = 3 + strlen(host) + ((domainName) ? strlen(domainName) : 0) + 3;
+    if (fits(fqdnLength))
+      currLoc += populateFQDN(packet->OPT, currLoc, fqdnFlags, host, domainName, leases->ddnsEnabled() && publishName);
   }
+  // RFC 3046 2.2: option 82 goes back unchanged, as the last option, in the room kept for it
+  if (agentOffset) currLoc += populatePacket(packet->OPT, currLoc, dhcpRelayAgentInfo, agentInfo, agentLength);
   packet->OPT[currLoc++] = dhcpEndOption;
 
-  return OPToffset + currLoc;
+  reply->add((const byte*) packet, DHCP_HEADER_SIZE);
+  reply->add((netBoot) ? bootFields : legacyFields, DHCP_LEGACY_SIZE);
+  reply->add(packet->magic, sizeof(packet->magic) + clientLoc);
+  reply->add(getConstantOptions(leaseTime), DHCP_CONSTANT_OPTIONS_SIZE);
+  reply->add(packet->OPT + clientLoc, currLoc - clientLoc);
+  selectDestination(packet, response, reply);
+  return reply->length;
 }
@@ -13,6 +13,10 @@
 #define DHCP_SERVER_PORT 67 /* port for server to listen on */
 #define DHCP_CLIENT_PORT 68 /* port for client to use */
 
+/* DHCP hardware type */
+#define DHCP_HTYPE_ETHERNET 1
+#define DHCP_HLEN_ETHERNET 6
+
 /* DHCP message OP code */
 #define DHCP_BOOTREQUEST 1
 #define DHCP_BOOTREPLY 2
@@ -26,6 +30,10 @@
 #define DHCP_NAK 6
 #define DHCP_RELEASE 7
 #define DHCP_INFORM 8
+#define DHCP_LEASEQUERY 10 /* RFC 4388 */
+#define DHCP_LEASEUNASSIGNED 11
+#define DHCP_LEASEUNKNOWN 12
+#define DHCP_LEASEACTIVE 13
 
 // #define DHCP_LEASETIME ((long)60*60*24) // Lease Time: 1 day == { 00, 01, 51, 80 }
 // #define DHCP_LEASETIME ((long) 150) // Lease Time:
@@ -96,9 +104,25 @@ enum {
   dhcpT2value = 59,
   dhcpClassIdentifier = 60,
   dhcpClientIdentifier = 61,
+  dhcpTFTPServerName = 66,
+  dhcpBootFileName = 67,
+  dhcpRapidCommit = 80,
+  dhcpClientFQDN = 81,
+  dhcpRelayAgentInfo = 82,
+  dhcpClientLastTransactionTime = 91,
   dhcpEndOption = 255
 };
 
+/* option 81 flags (RFC 4702) */
+#define DHCP_FQDN_S 0x01 /* server updates the A record */
+#define DHCP_FQDN_O 0x02 /* server overrode the client's S bit */
+#define DHCP_FQDN_E 0x04 /* name is in DNS wire format */
+#define DHCP_FQDN_N 0x08 /* server does no DNS updates */
+
+/* option 82 sub-options (RFC 3046) */
+#define DHCP_AGENT_CIRCUIT_ID 1
+#define DHCP_AGENT_REMOTE_ID 2
+
 /**
  * @brief		for the DHCP message
  */
@@ -123,6 +147,93 @@ struct RIP_MSG {
   byte OPT[]; // 240 offset
 };
 
-int DHCPreply(RIP_MSG* packet, int packetSize, byte* serverIP, const char* domainName);
+#define DHCP_OPTIONS_OFFSET 240 /* fixed BOOTP fields plus the magic cookie */
+#define DHCP_HEADER_SIZE 44  /* op through chaddr */
+#define DHCP_LEGACY_SIZE 192 /* sname and file */
+#define DHCP_PARAM_LIST_SIZE 64 /* PXE firmware asks for 30+ options, 66 and 67 among the last */
+#define DHCP_OPTION_CODES 256
+#define DHCP_CLIENT_ID_SIZE 64  /* longest client identifier echoed in a leasequery reply */
+#define DHCP_REPLY_SEGMENTS 5
+
+/**
+ * @brief		one contiguous run of reply bytes, streamed to the network untouched
+ */
+struct DHCPSegment {
+  const byte* data;
+  int length;
+};
+
+/**
+ * @brief		a reply described as a gather list instead of one contiguous packet
+ */
+struct DHCPReply {
+  DHCPSegment segment[DHCP_REPLY_SEGMENTS];
+  byte segments = 0;
+  int length = 0;
+  bool broadcast = true;               // send to the subnet broadcast address
+  byte destination[4] = {0, 0, 0, 0}; // unicast address when not broadcasting
+  uint16_t port = DHCP_CLIENT_PORT;
+  bool probe = false;                  // nothing to send yet: hold the request until probeLease is probed
+  byte probeLease = 0;
+
+  void add(const byte* data, int size) {
+    if (segments >= DHCP_REPLY_SEGMENTS) return;
+    segment[segments].data = data;
+    segment[segments].length = size;
+    segments++;
+    length += size;
+  }
+};
+
+class DHCPLeaseStore;
+
+/**
+ * @brief		addressing the engine advertises in its replies
+ */
+struct DHCPEngineConfig {
+  const byte* serverIP = nullptr;
+  const char* domainName = nullptr;
+};
+
+/**
+ * @brief		builds DHCP replies against an explicit lease store and configuration
+ *
+ * All working state lives in the instance or on the caller's stack, so separate engines can serve
+ * separate lease stores (or cores) at the same time.
+ */
+class DHCPEngine {
+public:
+  DHCPEngine(DHCPLeaseStore* __leases, const DHCPEngineConfig* __config) : leases(__leases), config(__config){};
+
+  int DHCPreply(RIP_MSG* packet, int packetSize, DHCPReply* reply);
+
+private:
+  DHCPLeaseStore* leases;
+  const DHCPEngineConfig* config;
+
+  void selectDestination(RIP_MSG* packet, byte response, DHCPReply* reply);
+  int leaseQuery(RIP_MSG* packet, int packetSize, DHCPReply* reply);
+
+  // where each option of the packet being answered starts, filled by one scan of the options
+  uint16_t optionAt[DHCP_OPTION_CODES];
+  byte optionLength[DHCP_OPTION_CODES];
+  void indexOptions(const byte* options, int size);
+  int option(byte code, int* length);
+
+  // sname and file for a network boot reply; every other reply uses the shared block of zeros
+  byte bootFields[DHCP_LEGACY_SIZE];
+
+  // option 82 of the request, kept while the options are rewritten and echoed as the last one
+  byte agentInfo[255];
+
+  // Options shared by every reply with the same lease time (server identifier and lease timers), rebuilt
+  // when the server address or the lease time changes
+#define DHCP_CONSTANT_OPTIONS_SIZE 24
+  byte constantOptions[DHCP_CONSTANT_OPTIONS_SIZE];
+  byte constantServerIP[4] = {0, 0, 0, 0};
+  unsigned long constantLeaseTime = 0;
+  bool constantValid = false;
+  const byte* getConstantOptions(unsigned long leaseTime);
+};
 
 #endif
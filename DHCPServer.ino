@@ -1,5 +1,9 @@
+#include "ddnsupdater.h"
 #include "dhcpserver.h"
+#include "dnsserver.h"
 #include "files/webpage_all.h"
+#include "leasesweeper.h"
+#include "tftpserver.h"
 
 #include <GavelEEProm.h>
 #include <GavelEthernet.h>
@@ -22,6 +26,10 @@ EEpromMemory memory;
 TelnetModule telnet;
 ServerModule server;
 DHCPServer dhcpServer;
+DNSServer dnsServer(&dhcpServer);
+DDNSUpdater ddnsUpdater(&dhcpServer);
+TFTPServer tftpServer(&dhcpServer);
+LeaseSweeper leaseSweeper(&dhcpServer);
 
 void setupDHCPServer() {
   ArrayDirectory* dir;
@@ -29,6 +37,10 @@ void setupDHCPServer() {
                        ethernetModule.getMACAddress());
   memory.setData(&dhcpServer);
   taskManager.add(&dhcpServer);
+  taskManager.add(&dnsServer);
+  taskManager.add(&ddnsUpdater);
+  taskManager.add(&tftpServer);
+  taskManager.add(&leaseSweeper);
   dir = static_cast<ArrayDirectory*>(fileSystem.open("/www"));
   dir->addFile(new StaticFile(dhcpconfightml_string, dhcpconfightml, dhcpconfightml_len));
   dir = static_cast<ArrayDirectory*>(fileSystem.open("/www/api"));
@@ -0,0 +1,46 @@
+#include "arpprobe.h"
+
+#include <utility/w5100.h>
+
+bool ArpProbe::start(const byte* address) {
+  if (busy()) return false;
+  if (!opened) opened = begin(ARP_PROBE_LOCAL_PORT);
+  if (!opened) return false;
+  while (parsePacket() > 0) flush(); // nothing useful ever arrives here
+  if (!beginPacket(IPAddress(address), ARP_PROBE_PORT)) return false;
+  write((uint8_t) 0);
+
+  // what endPacket() does, minus the wait for the outcome
+  SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+  W5100.writeSnIR(sockindex, SnIR::SEND_OK | SnIR::TIMEOUT);
+  W5100.execCmdSn(sockindex, Sock_SEND);
+  SPI.endTransaction();
+  state = ARP_PROBE_WAITING;
+  startedAt = millis();
+  return true;
+}
+
+// The outcome is reported once, then the probe is idle again
+byte ArpProbe::poll() {
+  if (state != ARP_PROBE_WAITING) return ARP_PROBE_IDLE;
+  SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+  byte interrupts = W5100.readSnIR(sockindex);
+  if (interrupts & (SnIR::SEND_OK | SnIR::TIMEOUT)) W5100.writeSnIR(sockindex, SnIR::SEND_OK | SnIR::TIMEOUT);
+  SPI.endTransaction();
+
+  byte result;
+  if (interrupts & SnIR::SEND_OK)
+    result = ARP_PROBE_ANSWERED;
+  else if ((interrupts & SnIR::TIMEOUT) || (millis() - startedAt >= ARP_PROBE_TIMEOUT))
+    result = ARP_PROBE_SILENT;
+  else
+    return ARP_PROBE_WAITING;
+  state = ARP_PROBE_IDLE;
+  return result;
+}
+
+void ArpProbe::close() {
+  if (busy() || !opened) return;
+  stop();
+  opened = false;
+}
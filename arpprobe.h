@@ -0,0 +1,38 @@
+#ifndef __DHCP_ARP_PROBE_H
+#define __DHCP_ARP_PROBE_H
+
+#include <EthernetUdp.h>
+
+#define ARP_PROBE_LOCAL_PORT 10009 /* local port the probes leave from */
+#define ARP_PROBE_PORT 9           /* discard; the datagram itself is never the point */
+#define ARP_PROBE_TIMEOUT 3000     /* backstop behind the W5500 ARP retries, in milliseconds */
+
+/* probe state, as returned by poll() */
+#define ARP_PROBE_IDLE 0
+#define ARP_PROBE_WAITING 1
+#define ARP_PROBE_ANSWERED 2 /* something on the wire owns the address */
+#define ARP_PROBE_SILENT 3   /* nobody answered the ARP request */
+
+/**
+ * @brief		asks the local network whether an address is in use, without blocking
+ *
+ * The W5500 resolves the destination of every UDP send with ARP on its own: SEND_OK means a host
+ * answered, TIMEOUT means nobody did. start() queues a one byte datagram and issues the SEND command
+ * directly, then poll() reads the socket interrupt bits on each task tick instead of spinning in
+ * endPacket() for the whole ARP retry period. One address is probed at a time, and only addresses on
+ * the attached network mean anything; anything else resolves to the gateway.
+ */
+class ArpProbe : public EthernetUDP {
+public:
+  bool start(const byte* address);
+  byte poll();
+  bool busy() { return state == ARP_PROBE_WAITING; }
+  void close();
+
+private:
+  bool opened = false;
+  byte state = ARP_PROBE_IDLE; // IDLE or WAITING
+  unsigned long startedAt = 0;
+};
+
+#endif // __DHCP_ARP_PROBE_H
@@ -28,6 +28,7 @@ case "$BUILD" in
     ;;
   --test)
     # run_tests $CURRENT_DIR $DO_SHOW
+    make -C "$CURRENT_DIR"/test
     exit $?
     ;;
   *)
@@ -0,0 +1,67 @@
+#ifndef __DHCP_DDNS_QUEUE_H
+#define __DHCP_DDNS_QUEUE_H
+
+#include <Arduino.h>
+
+#define DDNS_QUEUE_SIZE 16
+#define DDNS_NAME_SIZE 32 /* matches HOSTNAME_SIZE */
+
+/* DDNS event operations */
+#define DDNS_ADD 0
+#define DDNS_DELETE 1
+
+/**
+ * @brief		a DNS record to publish or withdraw for a lease
+ */
+struct DDNSEvent {
+  byte op;
+  byte ipAddress[4];
+  byte macAddress[6]; // the client's, which its DHCID record is derived from
+  char hostName[DDNS_NAME_SIZE];
+};
+
+/**
+ * @brief		fixed FIFO of DDNS events
+ *
+ * The DHCP side pushes as leases bind and go away; the updater sends the front event and pops it once
+ * the server has answered, so nothing waits on the network while a packet is being handled.
+ */
+class DDNSQueue {
+public:
+  bool empty() const { return count == 0; }
+  bool full() const { return count == DDNS_QUEUE_SIZE; }
+  byte size() const { return count; }
+
+  // false when the queue is full and the event is dropped
+  bool push(const DDNSEvent* event) {
+    if (full()) {
+      dropped++;
+      return false;
+    }
+    events[head] = *event;
+    head = (head + 1) % DDNS_QUEUE_SIZE;
+    count++;
+    return true;
+  }
+
+  // index 0 is the oldest pending event
+  const DDNSEvent* peek(byte index) const {
+    return (index < count) ? &events[(tail + index) % DDNS_QUEUE_SIZE] : nullptr;
+  }
+  void pop(byte number) {
+    if (number > count) number = count;
+    tail = (tail + number) % DDNS_QUEUE_SIZE;
+    count -= number;
+  }
+  void clear() { pop(count); }
+
+  unsigned long dropped = 0;
+
+private:
+  DDNSEvent events[DDNS_QUEUE_SIZE];
+  byte head = 0;
+  byte tail = 0;
+  byte count = 0;
+};
+
+#endif // __DHCP_DDNS_QUEUE_H
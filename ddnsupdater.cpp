@@ -0,0 +1,231 @@
+#include "ddnsupdater.h"
+
+#include "asciitable/asciitable.h"
+#include "sha256.h"
+
+static int writeLabels(byte* message, int offset, const char* name) {
+  while (name && *name) {
+    const char* dot = strchr(name, '.');
+    int length = (dot) ? dot - name : (int) strlen(name);
+    message[offset++] = length;
+    memcpy(message + offset, name, length);
+    offset += length;
+    name += length + ((dot) ? 1 : 0);
+  }
+  message[offset++] = 0;
+  return offset;
+}
+
+// <host>.<zone> record; the zone name is the one in the zone section at the start of the message
+static int writeRecord(byte* message, int offset, const char* host, uint16_t type, uint16_t dnsClass,
+                       unsigned long ttl, const byte* rdata, int rdLength) {
+  int length = strlen(host);
+  message[offset++] = length;
+  memcpy(message + offset, host, length);
+  offset += length;
+  dnsPutWord(message, offset, 0xC000 | DNS_HEADER_SIZE);
+  dnsPutWord(message, offset + 2, type);
+  dnsPutWord(message, offset + 4, dnsClass);
+  dnsPutWord(message, offset + 6, ttl >> 16);
+  dnsPutWord(message, offset + 8, ttl & 0xFFFF);
+  dnsPutWord(message, offset + 10, rdLength);
+  offset += 12;
+  if (rdLength) memcpy(message + offset, rdata, rdLength);
+  return offset + rdLength;
+}
+
+void DDNSUpdater::addCmd(TerminalCommand* __termCmd) {
+  __termCmd->addCmd("ddns", "[ip|off]", "Configures the server that takes DNS updates for leases.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { ddnsCommand(terminal); });
+}
+
+void DDNSUpdater::reservePins(BackendPinSetup* pinsetup) {
+  return;
+}
+
+bool DDNSUpdater::setupTask(OutputInterface* __terminal) {
+  id = rp2040.hwrand32();
+  setRefreshMilli(10);
+  return true;
+}
+
+bool DDNSUpdater::executeTask() {
+  unsigned long currTime = millis();
+  if (currTime - lastSweep >= DDNS_SWEEP_INTERVAL) {
+    lastSweep = currTime;
+    leases->expireHostNames(currTime);
+  }
+  // the socket is only held while there is a server to update, so it is free for HTTP or Telnet otherwise
+  if (!leases->ddnsEnabled()) {
+    leases->ddnsQueue.clear();
+    step = DDNS_IDLE;
+    if (listening) Udp.stop();
+    listening = false;
+    return true;
+  }
+  if (!listening) listening = Udp.begin(DDNS_LOCAL_PORT);
+  if (!listening) return true;
+
+  if (step != DDNS_IDLE) receiveResponse();
+  if (step != DDNS_IDLE) {
+    unsigned long timeout = (unsigned long) DDNS_TIMEOUT << attempt;
+    if (timeout > DDNS_BACKOFF_MAX) timeout = DDNS_BACKOFF_MAX;
+    if (currTime - sentAt >= timeout) {
+      if (attempt + 1 >= DDNS_RETRIES) {
+        stats.timedOut++;
+        finishEvent();
+      } else {
+        attempt++;
+        stats.retries++;
+        sendUpdate();
+      }
+    }
+  }
+  if ((step == DDNS_IDLE) && !leases->ddnsQueue.empty()) {
+    step = (leases->ddnsQueue.peek(0)->op == DDNS_ADD) ? DDNS_CLAIM : DDNS_REMOVE;
+    buildUpdate();
+    attempt = 0;
+    stats.messages++;
+    sendUpdate();
+  }
+  return true;
+}
+
+// RFC 4701 DHCID RDATA for the client behind an event: identifier type 0 (htype and chaddr), digest
+// type 1, and the SHA-256 of the identifier followed by the name in lower case wire format
+void DDNSUpdater::dhcidOf(const DDNSEvent* event, byte* rdata) {
+  char name[DNS_NAME_SIZE];
+  snprintf(name, sizeof(name), "%s.%s", event->hostName, leases->getDomainName());
+  for (char* c = name; *c; c++) *c = tolower(*c);
+  byte input[1 + DHCP_HLEN_ETHERNET + DNS_NAME_SIZE + 1];
+  input[0] = DHCP_HTYPE_ETHERNET;
+  memcpy(input + 1, event->macAddress, DHCP_HLEN_ETHERNET);
+  int length = writeLabels(input, 1 + DHCP_HLEN_ETHERNET, name);
+  rdata[0] = 0;
+  rdata[1] = 0;
+  rdata[2] = 1;
+  sha256(input, length, rdata + 3);
+}
+
+// One UPDATE for the front of the queue, conditioned as RFC 4703 asks: a name is claimed only while
+// nobody holds it, and replaced or withdrawn only while it carries this client's DHCID, so a name that
+// belongs to another client or was entered by hand is never touched. Prerequisites hold for a whole
+// message, so each event gets its own.
+void DDNSUpdater::buildUpdate() {
+  const DDNSEvent* event = leases->ddnsQueue.peek(0);
+  byte dhcid[DHCID_SIZE];
+  dhcidOf(event, dhcid);
+  int loc = writeLabels(message, DNS_HEADER_SIZE, leases->getDomainName());
+  dnsPutWord(message, loc, DNS_TYPE_SOA);
+  dnsPutWord(message, loc + 2, DNS_CLASS_IN);
+  loc += 4;
+
+  const char* host = event->hostName;
+  if (step == DDNS_CLAIM) {
+    // name is not in use (RFC 2136 2.4.5), then the address and the DHCID
+    loc = writeRecord(message, loc, host, DNS_TYPE_ANY, DNS_CLASS_NONE, 0, nullptr, 0);
+    loc = writeRecord(message, loc, host, DNS_TYPE_A, DNS_CLASS_IN, DDNS_TTL, event->ipAddress, 4);
+    loc = writeRecord(message, loc, host, DNS_TYPE_DHCID, DNS_CLASS_IN, DDNS_TTL, dhcid, DHCID_SIZE);
+  } else {
+    // the DHCID RRset exists with this client's value (RFC 2136 2.4.2)
+    loc = writeRecord(message, loc, host, DNS_TYPE_DHCID, DNS_CLASS_IN, 0, dhcid, DHCID_SIZE);
+    if (step == DDNS_REPLACE) {
+      loc = writeRecord(message, loc, host, DNS_TYPE_A, DNS_CLASS_ANY, 0, nullptr, 0);
+      loc = writeRecord(message, loc, host, DNS_TYPE_A, DNS_CLASS_IN, DDNS_TTL, event->ipAddress, 4);
+    } else {
+      loc = writeRecord(message, loc, host, DNS_TYPE_A, DNS_CLASS_NONE, 0, event->ipAddress, 4);
+      loc = writeRecord(message, loc, host, DNS_TYPE_DHCID, DNS_CLASS_ANY, 0, nullptr, 0);
+    }
+  }
+
+  dnsPutWord(message, 0, id);
+  dnsPutWord(message, 2, DNS_OPCODE_UPDATE << 11);
+  dnsPutWord(message, 4, 1);  // zone
+  dnsPutWord(message, 6, 1);  // prerequisites
+  dnsPutWord(message, 8, 2);  // updates
+  dnsPutWord(message, 10, 0); // additional
+  messageLength = loc;
+}
+
+void DDNSUpdater::sendUpdate() {
+  Udp.beginPacket(IPAddress(leases->getDDNSServer()), DNS_PORT);
+  Udp.write(message, messageLength);
+  Udp.endPacket();
+  sentAt = millis();
+}
+
+void DDNSUpdater::receiveResponse() {
+  for (byte i = 0; i < DDNS_READS; i++) {
+    if (Udp.parsePacket() <= 0) return;
+    byte header[DNS_HEADER_SIZE];
+    if (Udp.read(header, DNS_HEADER_SIZE) < DNS_HEADER_SIZE) continue;
+    if (!(Udp.remoteIP() == IPAddress(leases->getDDNSServer()))) continue;
+    uint16_t flags = dnsGetWord(header, 2);
+    if (!(flags & DNS_FLAG_QR) || (DNS_OPCODE(flags) != DNS_OPCODE_UPDATE) || (dnsGetWord(header, 0) != id)) continue;
+
+    byte rcode = flags & 0x0F;
+    if ((step == DDNS_CLAIM) && (rcode == DNS_RCODE_YXDOMAIN)) {
+      // the name is taken; it is still ours to update if it carries this client's DHCID
+      step = DDNS_REPLACE;
+      id = rp2040.hwrand32();
+      buildUpdate();
+      attempt = 0;
+      stats.messages++;
+      sendUpdate();
+      return;
+    }
+    if (rcode == DNS_RCODE_NOERROR)
+      stats.updated++;
+    else if (rcode == DNS_RCODE_NXRRSET)
+      stats.conflicts++;
+    else
+      stats.rejected++; // REFUSED/NOTAUTH/NOTZONE will not change on a retry
+    finishEvent();
+    return;
+  }
+}
+
+void DDNSUpdater::finishEvent() {
+  leases->ddnsQueue.pop(1);
+  step = DDNS_IDLE;
+  id = rp2040.hwrand32(); // unpredictable, so a spoofed response cannot be matched to the next update
+}
+
+void DDNSUpdater::ddnsCommand(OutputInterface* terminal) {
+  char buffer[20];
+  byte address[4];
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    terminal->print(INFO, "DDNS Server: ");
+    if (leases->ddnsEnabled())
+      terminal->println(INFO, getIPString(leases->getDDNSServer(), buffer, sizeof(buffer)));
+    else
+      terminal->println(INFO, "Disabled");
+
+    AsciiTable table(terminal);
+    table.addColumn(Normal, "Outcome", 20);
+    table.addColumn(Yellow, "Count", 12);
+    table.printHeader();
+    auto row = [&](const char* outcome, unsigned long count) { table.printData(outcome, ultoa(count, buffer, 10)); };
+    row("Messages", stats.messages);
+    row("Retries", stats.retries);
+    row("Updated", stats.updated);
+    row("Conflicts", stats.conflicts);
+    row("Rejected", stats.rejected);
+    row("Timed Out", stats.timedOut);
+    row("Queued", leases->ddnsQueue.size());
+    row("Queue Full", leases->ddnsQueue.dropped);
+    table.printDone("DDNS Updates");
+  } else if (strcmp(value, "off") == 0) {
+    memset(address, 0, sizeof(address));
+    leases->setDDNSServer(address);
+    leases->setInternal(true);
+    terminal->println(PASSED, "DDNS Updates Disabled");
+  } else if (parseIPAddress(value, address)) {
+    leases->setDDNSServer(address);
+    leases->setInternal(true);
+    terminal->println(PASSED, "DDNS Updates Enabled");
+  } else
+    terminal->println(ERROR, "IP Address is invalid");
+  terminal->prompt();
+}
@@ -0,0 +1,86 @@
+#ifndef __DHCP_DDNS_UPDATER_H
+#define __DHCP_DDNS_UPDATER_H
+
+#include "dhcpserver.h"
+#include "dnsserver.h"
+
+#include <EthernetUdp.h>
+#include <GavelInterfaces.h>
+#include <GavelTask.h>
+
+#define DDNS_LOCAL_PORT 10054   /* local port the updates leave from */
+#define DDNS_READS 4            /* datagrams read per tick looking for the answer */
+#define DDNS_TTL 300            /* TTL of the published A records, in seconds */
+#define DDNS_TIMEOUT 1000       /* first retry, doubled on each attempt, in milliseconds */
+#define DDNS_BACKOFF_MAX 16000  /* longest wait between attempts, in milliseconds */
+#define DDNS_RETRIES 5
+#define DDNS_SWEEP_INTERVAL 1000 /* how often expired leases are withdrawn, in milliseconds */
+
+#define DNS_OPCODE_UPDATE 5
+#define DNS_CLASS_NONE 254
+#define DNS_CLASS_ANY 255
+#define DNS_TYPE_DHCID 49
+#define DNS_RCODE_YXDOMAIN 6
+#define DNS_RCODE_NXRRSET 8
+#define DHCID_SIZE 35 /* identifier type, digest type and a SHA-256 digest (RFC 4701) */
+
+/* RFC 4703 steps of the event in flight */
+#define DDNS_IDLE 0
+#define DDNS_CLAIM 1   /* add the name, provided nobody holds it */
+#define DDNS_REPLACE 2 /* the name exists: update it, provided it carries this client's DHCID */
+#define DDNS_REMOVE 3  /* withdraw the name, provided it carries this client's DHCID */
+
+/**
+ * @brief		DDNS updates, by outcome
+ */
+struct DDNSStats {
+  unsigned long messages; // UPDATE messages sent, not counting retries
+  unsigned long retries;
+  unsigned long updated;   // events the server accepted
+  unsigned long conflicts; // names left alone because another client's DHCID (or none) is on them
+  unsigned long rejected;  // events the server answered with an error
+  unsigned long timedOut;  // events given up after the last retry
+};
+
+/**
+ * @brief		RFC 2136 updater for the leased host names
+ *
+ * Takes the events the DHCP side queues as names are bound and withdrawn, and sends them to the
+ * configured server as A record updates in the domain. Each name carries a DHCID record naming the
+ * client (RFC 4701), and every update is conditioned on it the way RFC 4703 describes, so names this
+ * server did not register for the same client are never overwritten or removed. One UPDATE is in flight
+ * at a time; it is retried with a doubling timeout and the event is dropped after the last retry, so a
+ * missing server never holds up anything else.
+ */
+class DDNSUpdater : public Task {
+public:
+  DDNSUpdater(DHCPServer* __leases) : Task("DDNSUpdater"), leases(__leases){};
+  virtual void addCmd(TerminalCommand* __termCmd) override;
+  virtual void reservePins(BackendPinSetup* pinsetup) override;
+  virtual bool setupTask(OutputInterface* __terminal) override;
+  virtual bool executeTask() override;
+
+  void ddnsCommand(OutputInterface* terminal);
+
+  DDNSStats stats = {};
+
+private:
+  void buildUpdate();
+  void dhcidOf(const DDNSEvent* event, byte* rdata);
+  void sendUpdate();
+  void receiveResponse();
+  void finishEvent();
+
+  EthernetUDP Udp;
+  bool listening = false; // the local port is open
+  DHCPServer* leases;
+  alignas(4) byte message[DNS_MESSAGE_SIZE];
+  int messageLength = 0;
+  byte step = DDNS_IDLE; // of the event at the front of the queue
+  uint16_t id = 0;
+  byte attempt = 0;
+  unsigned long sentAt = 0;
+  unsigned long lastSweep = 0;
+};
+
+#endif // __DHCP_DDNS_UPDATER_H
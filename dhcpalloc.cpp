@@ -0,0 +1,62 @@
+#include "dhcpalloc.h"
+
+#ifdef DHCP_ALLOC_TRACE
+
+#include <malloc.h>
+#include <new>
+
+volatile AllocStats allocStats = {0, 0, 0, 0, nullptr};
+
+size_t allocInUse() {
+  struct mallinfo info = mallinfo();
+  return info.uordblks;
+}
+
+static void* countedAlloc(size_t size) {
+  allocStats.allocations++;
+  void* ptr = malloc(size ? size : 1);
+  if (ptr == nullptr) abort();
+  return ptr;
+}
+
+static void countedFree(void* ptr) {
+  if (ptr == nullptr) return;
+  allocStats.releases++;
+  free(ptr);
+}
+
+void* operator new(size_t size) {
+  return countedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+  return countedAlloc(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  allocStats.allocations++;
+  return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  allocStats.allocations++;
+  return malloc(size ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept {
+  countedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  countedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  countedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  countedFree(ptr);
+}
+
+#endif // DHCP_ALLOC_TRACE
@@ -0,0 +1,53 @@
+#ifndef __DHCP_ALLOC_H
+#define __DHCP_ALLOC_H
+
+// Heap allocation accounting for the DHCP packet path.
+//
+// Build with -DDHCP_ALLOC_TRACE to count every operator new/delete and to watch the malloc arena
+// in use (Arduino String goes straight to malloc/realloc, so it shows up there). An AllocScope
+// placed around a code path records a violation whenever that path touches the heap, so a test
+// build can prove executeTask -> DHCPreply -> lease operations stay allocation free. Without the
+// flag the scope compiles away.
+
+#include <Arduino.h>
+
+struct AllocStats {
+  unsigned long allocations;
+  unsigned long releases;
+  unsigned long scopes;
+  unsigned long violations;
+  const char* lastViolation;
+};
+
+#ifdef DHCP_ALLOC_TRACE
+
+extern volatile AllocStats allocStats;
+
+size_t allocInUse();
+
+class AllocScope {
+public:
+  AllocScope(const char* __name) : name(__name), allocations(allocStats.allocations), inUse(allocInUse()){};
+  ~AllocScope() {
+    allocStats.scopes++;
+    if ((allocStats.allocations != allocations) || (allocInUse() != inUse)) {
+      allocStats.violations++;
+      allocStats.lastViolation = name;
+    }
+  };
+
+private:
+  const char* name;
+  unsigned long allocations;
+  size_t inUse;
+};
+
+#define DHCP_NO_ALLOC_SCOPE(name) AllocScope __allocScope(name)
+
+#else
+
+#define DHCP_NO_ALLOC_SCOPE(name)
+
+#endif // DHCP_ALLOC_TRACE
+
+#endif // __DHCP_ALLOC_H
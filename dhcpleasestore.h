@@ -0,0 +1,155 @@
+#ifndef __DHCP_LEASE_STORE_H
+#define __DHCP_LEASE_STORE_H
+
+#include "DHCPLite.h"
+#include "dhcputil.h"
+
+#define INVALID_LEASE 0xFF
+#define LOCAL_SUBNET 0 /* subnet 0 is the directly attached network; 1..RELAY_SUBNETS are relayed */
+#define INVALID_SUBNET 0xFF
+#define INVALID_PORT 0xFF
+#define INVALID_POOL 0xFF
+
+/* DHCP lease status */
+#define DHCP_LEASE_AVAIL 0
+#define DHCP_LEASE_OFFER 1
+#define DHCP_LEASE_ACK 2
+#define DHCP_LEASE_DECLINED 3
+
+#define DHCP_PROBE_HOLD 30000 /* how long a probed address stays reserved, in milliseconds */
+
+/* options a client class profile can leave out of or add to its replies */
+#define PROFILE_SUBNET_MASK 0x01
+#define PROFILE_ROUTER 0x02
+#define PROFILE_DNS 0x04
+#define PROFILE_LOG_SERVER 0x08
+#define PROFILE_DOMAIN_NAME 0x10
+#define PROFILE_TFTP_SERVER 0x20
+#define PROFILE_BOOT_FILE 0x40
+#define PROFILE_OPTIONS 7
+
+/**
+ * @brief		datagrams rejected by the receive filter, by reason
+ */
+struct DropStats {
+  unsigned long runt;           // too short for the BOOTP header, cookie and an option
+  unsigned long notRequest;     // op is not BOOTREQUEST
+  unsigned long badHardware;    // htype/hlen are not Ethernet
+  unsigned long badCookie;      // no DHCP magic cookie (plain BOOTP or not DHCP at all)
+  unsigned long malformed;      // option runs past the end of the datagram
+  unsigned long noMessageType;  // no message type option
+  unsigned long badType;        // server-to-client or unknown message type
+  unsigned long otherServer;    // addressed to another server identifier
+  unsigned long untrustedQuery; // leasequery from a requester that may not see the bindings
+};
+
+/**
+ * @brief		a subnet served through a relay agent
+ *
+ * Leases for relay subnets are taken from the lease table after the local range, in table order.
+ */
+struct SubnetConfig {
+  byte network[4];    // matched against giaddr under subnetMask
+  byte subnetMask[4];
+  byte router[4];     // 0.0.0.0 uses the relay (giaddr) itself
+  byte dns[4];        // 0.0.0.0 uses this server
+  byte startAddress;  // first host number handed out
+  byte leaseNum;      // 0 disables the subnet
+  byte spare[2];
+};
+
+/**
+ * @brief		reply options for the clients of a range, as PROFILE_* bits
+ */
+struct ClassProfile {
+  byte omit; // left out even when the client asks for them
+  byte send; // sent even when the client does not ask for them
+  byte spare[2];
+};
+
+/**
+ * @brief		network boot settings for the clients of a range
+ */
+struct BootConfig {
+  byte nextServer[4]; // siaddr and option 66; 0.0.0.0 uses this server and its TFTP task
+  char bootFile[64];  // file and option 67; empty disables network boot (not null terminated when full)
+};
+
+/**
+ * @brief		the lease operations a DHCPEngine answers from
+ *
+ * DHCPServer keeps its bindings in EEPROM backed tables; anything else holding leases (a second server,
+ * a host test) only has to provide these.
+ */
+class DHCPLeaseStore {
+public:
+  virtual ~DHCPLeaseStore(){};
+
+  /* Subnets and Pools */
+  virtual byte getSubnetForRelay(const byte* giaddr) = 0;
+  virtual byte getLeaseSubnet(byte lease) = 0;
+  virtual bool addressInSubnet(byte subnet, const byte* address) = 0;
+  virtual byte selectPool(byte subnet, const byte* __macAddress, const byte* vendorClass, int vendorLength) = 0;
+  virtual byte getLeasePool(byte lease) = 0;
+  virtual unsigned long getPoolLeaseTime(byte pool) = 0;
+  virtual void getPoolConfig(byte pool, SubnetConfig* config) = 0;
+  virtual bool getPoolBoot(byte pool, BootConfig* boot) = 0;
+  virtual void getPoolProfile(byte pool, ClassProfile* profile) = 0;
+  virtual bool getRapidCommit() = 0;
+  virtual bool ddnsEnabled() = 0;
+
+  /* Reservations and Relay Ports */
+  virtual const byte* getReservedAddress(const byte* __macAddress) = 0;
+  virtual byte getPortByAgentInfo(const byte* agentInfo, int length) = 0;
+  virtual byte getPortPool(byte port, byte subnet, byte pool) = 0;
+  virtual const byte* getPortAddress(byte port) = 0;
+  virtual bool queryRequesterTrusted(const byte* giaddr) = 0;
+
+  /* Lookups */
+  virtual unsigned long clientIdHash(const byte* clientId, int length) = 0;
+  virtual byte getLease(byte* __macAddress, unsigned long clientId) = 0;
+  virtual byte getLeaseByClientId(unsigned long clientId) = 0;
+  virtual byte getLeaseByMAC(const byte* __macAddress) = 0;
+  virtual byte getLeaseByIPAddress(const byte* __ipAddress) = 0;
+  virtual byte getNewLease(byte pool = LOCAL_SUBNET, const byte* __macAddress = nullptr) = 0;
+  virtual bool validLease(byte lease) = 0;
+  virtual bool validLeaseNumber(byte lease) = 0;
+  virtual bool leaseAvailable(byte lease) = 0;
+
+  /* Bindings */
+  virtual void setLease(byte lease, byte* __macAddress, long expires = 0, byte status = DHCP_LEASE_AVAIL,
+                        unsigned long clientId = 0) = 0;
+  virtual void deleteLease(byte lease) = 0;
+  virtual void releaseLease(byte lease) = 0;
+  virtual void declineLease(byte lease, unsigned long least = 0) = 0;
+  virtual bool probeWanted(byte subnet) = 0;
+  virtual bool probingLease(byte lease) = 0;
+  virtual bool setHostName(byte lease, const char* name, int length, bool publish = true) = 0;
+  virtual const char* getHostName(byte lease) = 0;
+
+  virtual byte* getLeaseMACAddress(byte lease) = 0;
+  virtual bool getLeaseIPAddress(byte lease, byte* ipAddress) = 0;
+  virtual byte getLeaseStatus(byte lease) = 0;
+  virtual bool getLeaseExpired(byte lease, long timeMs) = 0;
+  virtual long getLeaseExpiresSec(byte lease, long timeMs) = 0;
+
+  virtual DropStats* getDropStats() = 0;
+
+  // PROFILE_* bit for a reply option, 0 when a profile cannot carry it, and the other way around
+  static byte profileBit(byte option) {
+    for (byte i = 0; i < PROFILE_OPTIONS; i++)
+      if (profileOption(1 << i) == option) return 1 << i;
+    return 0;
+  }
+  static byte profileOption(byte bit) {
+    // option code for each PROFILE_* bit, lowest bit first
+    static const byte profileOptions[PROFILE_OPTIONS] = {dhcpSubnetMask,  dhcpRoutersOnSubnet, dhcpDns,
+                                                         dhcpLogServer,   dhcpDomainName,      dhcpTFTPServerName,
+                                                         dhcpBootFileName};
+    for (byte i = 0; i < PROFILE_OPTIONS; i++)
+      if (bit == (1 << i)) return profileOptions[i];
+    return dhcpPadOption;
+  }
+};
+
+#endif // __DHCP_LEASE_STORE_H
@@ -1,10 +1,18 @@
 #ifndef __DCHP_SERVER_H
 #define __DCHP_SERVER_H
 
+#include "DHCPLite.h"
+#include "arpprobe.h"
+#include "ddnsqueue.h"
+#include "dhcpleasestore.h"
+#include "packetring.h"
+
 #include <EthernetUdp.h>
 #include <GavelInterfaces.h>
 #include <GavelTask.h>
 
+#define RELAY_ID_SIZE 16 /* longest circuit or remote id a port can be matched on */
+
 struct LeaseMac {
   byte macAddress[6];
 };
@@ -14,16 +22,153 @@ struct LeaseStatus {
   long status;
 };
 
+/**
+ * @brief		time spent handing replies to the W5500, from beginPacket through endPacket
+ */
+struct ReplyStats {
+  unsigned long replies;
+  unsigned long bytes;
+  unsigned long micros;      // total
+  unsigned long worstMicros; // slowest single reply
+};
+
+/**
+ * @brief		a DISCOVER held back while its new address is probed
+ */
+struct ProbeTransaction {
+  bool active;
+  bool probing;   // the ARP probe is out for this one; otherwise it waits its turn
+  byte lease;     // address held in OFFER state for the client meanwhile
+  byte attempts;  // addresses tried so far
+  unsigned long heldAt;
+  PacketSlot packet; // the DISCOVER as it arrived, answered once the probe is done
+};
+
+/**
+ * @brief		conflict probes, by outcome
+ */
+struct ProbeStats {
+  unsigned long probes;    // addresses probed
+  unsigned long conflicts; // answered, so the address was quarantined
+  unsigned long offered;   // replies sent after a probe came back silent
+  unsigned long busy;      // DISCOVERs dropped with every transaction in use
+  unsigned long abandoned; // DISCOVERs dropped after DHCP_PROBE_ATTEMPTS conflicts in a row
+};
+
+/**
+ * @brief		ARP sweeps of the bound addresses, by outcome
+ */
+struct SweepStats {
+  unsigned long sweeps;    // passes over the lease table completed
+  unsigned long probes;
+  unsigned long answered;
+  unsigned long marked;    // leases expired early after too many silent sweeps
+  unsigned long reclaimed; // marked leases later handed to another client
+  unsigned long returned;  // marked leases renewed by their own client after all
+};
+
+/**
+ * @brief		a block of addresses inside a subnet with its own lease time and options
+ *
+ * Clients are steered into a range by the OUI of their MAC address or by a vendor class (option 60)
+ * prefix. Addresses of a subnet not covered by any range form that subnet's default pool.
+ */
+struct RangeConfig {
+  byte subnet;          // LOCAL_SUBNET or a relay subnet
+  byte startAddress;    // first host number of the range
+  byte leaseNum;        // 0 disables the range
+  byte matchType;       // RANGE_MATCH_*
+  byte oui[3];          // RANGE_MATCH_OUI: first three bytes of the MAC address
+  byte spare;
+  char vendorClass[16]; // RANGE_MATCH_VENDOR: option 60 prefix (not null terminated when full)
+  unsigned long leaseTime; // 0 uses the server lease time
+  byte router[4];       // 0.0.0.0 uses the subnet router
+  byte dns[4];          // 0.0.0.0 uses the subnet DNS
+};
+
+/**
+ * @brief		one node of the vendor class prefix trie, chained first child / next sibling
+ */
+struct ClassTrieNode {
+  char label;
+  byte child;   // 0 when there is none; the root is never anyone's child
+  byte sibling;
+  byte ranges;  // bit per range whose prefix ends here
+};
+
+/**
+ * @brief		a switch port, named by the relay agent information (option 82) its relay adds
+ *
+ * Whatever is plugged into the port gets the fixed address, or else an address from the range, so a
+ * replaced device comes back at the same place. An empty remote id matches the circuit id on any relay.
+ */
+struct PortConfig {
+  byte circuitId[RELAY_ID_SIZE]; // sub-option 1
+  byte remoteId[RELAY_ID_SIZE];  // sub-option 2
+  byte circuitLength;            // 0 disables the entry
+  byte remoteLength;
+  byte range;                    // range to allocate from, or PORT_NO_RANGE
+  byte spare;
+  byte ipAddress[4];             // fixed address for the port, 0.0.0.0 to use the range
+};
+
+/**
+ * @brief		a fixed MAC to address binding, kept sorted by MAC address
+ */
+struct Reservation {
+  byte macAddress[6];
+  byte ipAddress[4];
+};
+
+/**
+ * @brief		last address a client held, kept after its lease is gone
+ */
+struct GhostEntry {
+  byte macAddress[6];
+  byte ipAddress[4];
+};
+
+/* free address selection */
+#define ALLOC_LOWEST 0 /* lowest free address first */
+#define ALLOC_LRU 1    /* least recently freed address first */
+
+#define RANGE_MATCH_NONE 0
+#define RANGE_MATCH_OUI 1
+#define RANGE_MATCH_VENDOR 2
+
 #define LEASESNUM 100
-#define INVALID_LEASE 0xFF
-/* DHCP lease status */
-#define DHCP_LEASE_AVAIL 0
-#define DHCP_LEASE_OFFER 1
-#define DHCP_LEASE_ACK 2
+#define RELAY_SUBNETS 4
+#define DHCP_RANGES 4
+#define DHCP_RESERVATIONS 32
+#define DHCP_GHOSTS 16
+#define CLIENT_ID_BUCKETS 64 /* power of two */
+#define MAC_BUCKETS 64       /* power of two */
+#define DHCP_PORTS 8
+#define DHCP_QUERY_REQUESTERS 4 /* leasequery requesters; with none listed, any served subnet may ask */
+#define PORT_BUCKETS 16      /* power of two */
+#define PORT_NO_RANGE 0xFF
+#define HOSTNAME_SIZE 32      /* longest stored host name, including the terminator */
+#define HOSTNAME_SLOTS LEASESNUM /* one per lease, so a name is never turned away for want of a slot */
+#define HOSTNAME_BUCKETS 64   /* power of two */
+#define INVALID_SLOT 0xFF
+#define CLASS_TRIE_NODES (DHCP_RANGES * 16 + 1) /* every vendor prefix at full length, plus the root */
+static_assert(DDNS_NAME_SIZE == HOSTNAME_SIZE, "DDNS events carry a whole host name");
+/* pools 0..RELAY_SUBNETS are the subnet defaults; the ranges follow */
+#define DHCP_POOLS (RELAY_SUBNETS + 1 + DHCP_RANGES)
+#define RANGE_POOL(range) (RELAY_SUBNETS + 1 + (range))
+
+#define DHCP_DECLINE_TIME 3600 /* default quarantine for a declined address, in seconds */
 
-class DHCPServer : public IMemory, public Task {
+#define DHCP_PROBES 4          /* DISCOVERs that can wait on a conflict probe at once */
+#define DHCP_PROBE_ATTEMPTS 3  /* addresses tried for one DISCOVER before it is dropped */
+#define DHCP_CONFLICT_TIME 3600 /* least quarantine for an address a probe found in use, in seconds */
+
+#define SWEEP_MISSES 3 /* default silent sweeps before a lease is marked reclaimable */
+#define SWEEP_MARKED 0xFF
+
+class DHCPServer : public IMemory, public Task, public DHCPLeaseStore {
 public:
-  DHCPServer() : IMemory("DHCPServer"), Task("DHCPServer"){};
+  DHCPServer() : IMemory("DHCPServer"), Task("DHCPServer"), engine(this, &engineConfig){};
   virtual void addCmd(TerminalCommand* __termCmd) override;
   virtual void reservePins(BackendPinSetup* pinsetup) override;
   virtual bool setupTask(OutputInterface* __terminal) override;
@@ -33,11 +178,30 @@ public:
     byte startAddressNumber;
     byte leaseNum;
     unsigned long leaseTime;
-    byte spare[30];
+    unsigned long declineTime;
+    byte rapidCommit;
+    byte reservationNum;
+    byte ghostPersist;
+    byte ghostNext;
+    byte allocMode;
+    byte dnsUpstream[4]; // resolver the DNS task forwards to, 0.0.0.0 when forwarding is off
+    byte ddnsServer[4];  // server taking RFC 2136 updates for the domain, 0.0.0.0 when off
+    byte conflictProbe;  // ARP probe a new address before offering it
+    byte sweepMisses;    // silent ARP sweeps before a bound lease is reclaimable, 0 when sweeping is off
+    byte spare[9];
     LeaseMac leasesMac[LEASESNUM];
+    SubnetConfig subnets[RELAY_SUBNETS];
+    RangeConfig ranges[DHCP_RANGES];
+    Reservation reservations[DHCP_RESERVATIONS];
+    GhostEntry ghosts[DHCP_GHOSTS];
+    BootConfig boot[DHCP_RANGES];
+    PortConfig ports[DHCP_PORTS];
+    ClassProfile profiles[DHCP_RANGES];
+    unsigned long leaseClientId[LEASESNUM]; // hash of option 61 per lease, 0 when the client sent none
+    byte queryRequesters[DHCP_QUERY_REQUESTERS][4]; // allowed leasequery giaddrs, 0.0.0.0 for unused
   };
 
-  static_assert(sizeof(MemoryStruct) == 640, "DHCPMemory size unexpected - check packing/padding.");
+  static_assert(sizeof(MemoryStruct) == 2364, "DHCPMemory size unexpected - check packing/padding.");
 
   typedef union {
     MemoryStruct mem;
@@ -70,6 +234,8 @@ public:
   virtual void printData(OutputInterface* terminal) override;
   virtual void updateExternal() {
     updateBroadcast();
+    if (!memory.mem.ghostPersist) clearHistory();
+    rebuildFreeIndex();
     setInternal(true);
   }
   virtual JsonDocument createJson() override;
@@ -78,27 +244,126 @@ public:
   /* Lease Control Methods */
   unsigned long getLeaseTime();
   bool setLeaseTime(unsigned long time);
+  unsigned long getDeclineTime();
+  bool setDeclineTime(unsigned long time);
+  virtual bool getRapidCommit() override;
+  void setRapidCommit(bool enable);
+
+  const char* getDomainName() { return domainName; }
+  const byte* getDNSUpstream() { return memory.mem.dnsUpstream; }
+  void setDNSUpstream(const byte* address) { memcpy(memory.mem.dnsUpstream, address, 4); }
+  const byte* getDDNSServer() { return memory.mem.ddnsServer; }
+  void setDDNSServer(const byte* address) { memcpy(memory.mem.ddnsServer, address, 4); }
+  bool getConflictProbe() { return memory.mem.conflictProbe != 0; }
+  void setConflictProbe(bool enable) { memory.mem.conflictProbe = (enable) ? 1 : 0; }
+  byte getSweepMisses() { return memory.mem.sweepMisses; }
+  void setSweepMisses(byte misses) { memory.mem.sweepMisses = misses; }
+  virtual bool ddnsEnabled() override { return !zeroAddress(memory.mem.ddnsServer); }
+
+  /* Subnet Control Methods */
+  byte leaseCount();
+  virtual byte getSubnetForRelay(const byte* giaddr) override;
+  virtual byte getLeaseSubnet(byte lease) override;
+  bool getSubnetRange(byte subnet, byte* base, byte* count);
+  void getSubnetConfig(byte subnet, SubnetConfig* config);
+  bool setSubnetConfig(byte subnet, const SubnetConfig* config);
+  bool setLocalRange(byte start, byte num);
+  virtual bool addressInSubnet(byte subnet, const byte* address) override;
+
+  /* Address History Methods */
+  void rememberLease(byte lease);
+  const byte* getRememberedAddress(const byte* __macAddress);
+  void clearHistory();
+
+  /* Reservation Control Methods */
+  virtual const byte* getReservedAddress(const byte* __macAddress) override;
+  bool reservedAddress(const byte* address);
+  bool addReservation(const byte* __macAddress, const byte* address);
+  bool removeReservation(const byte* __macAddress);
+
+  /* Pool Control Methods */
+  virtual byte selectPool(byte subnet, const byte* __macAddress, const byte* vendorClass, int vendorLength) override;
+  virtual byte getLeasePool(byte lease) override;
+  virtual unsigned long getPoolLeaseTime(byte pool) override;
+  virtual void getPoolConfig(byte pool, SubnetConfig* config) override;
+  bool setRangeConfig(byte range, const RangeConfig* config);
+  virtual bool getPoolBoot(byte pool, BootConfig* boot) override;
+  bool setBootConfig(byte range, const BootConfig* boot);
+  bool localBootWanted();
+  void rebuildFreeIndex();
+
+  /* Conflict Probe Methods */
+  virtual bool probeWanted(byte subnet) override;
+  virtual bool probingLease(byte lease) override;
+  bool probesWaiting();
+
+  /* ARP Sweep Methods */
+  bool sweepCandidate(byte lease);
+  void sweepResult(byte lease, bool answered);
+  byte sweepMarkedCount();
+
+  /* Client Class Methods */
+  byte matchVendorClass(const byte* vendorClass, int length);
+  virtual void getPoolProfile(byte pool, ClassProfile* profile) override;
+  bool setClassProfile(byte range, const ClassProfile* profile);
+  void rebuildClassTrie();
+
+  /* Leasequery Methods */
+  virtual bool queryRequesterTrusted(const byte* giaddr) override;
+  bool addQueryRequester(const byte* address);
+  bool removeQueryRequester(const byte* address);
+
+  /* Relay Port Methods */
+  virtual byte getPortByAgentInfo(const byte* agentInfo, int length) override;
+  virtual byte getPortPool(byte port, byte subnet, byte pool) override;
+  virtual const byte* getPortAddress(byte port) override;
+  bool setPortConfig(byte port, const PortConfig* config);
+  void rebuildPortIndex();
+  static bool parseRelayId(const char* text, byte* id, byte* length);
+  static char* relayIdString(const byte* id, byte length, char* buffer, int size);
 
-  bool validLease(byte lease);
-  bool validLeaseNumber(byte lease);
-  void setLease(byte lease, byte* __macAddress, long expires = 0, byte status = DHCP_LEASE_AVAIL);
+  /* Client Identifier Methods */
+  virtual unsigned long clientIdHash(const byte* clientId, int length) override;
+  virtual byte getLeaseByClientId(unsigned long clientId) override;
+  virtual byte getLeaseByMAC(const byte* __macAddress) override;
+  void rebuildClientIdIndex();
+
+  /* Host Name Methods */
+  virtual bool setHostName(byte lease, const char* name, int length, bool publish = true) override;
+  void clearHostName(byte lease);
+  virtual const char* getHostName(byte lease) override;
+  byte getLeaseByHostName(const char* name, int length);
+  void resetHostNames();
+  void expireHostNames(long timeMs);
+
+  virtual bool validLease(byte lease) override;
+  virtual bool validLeaseNumber(byte lease) override;
+  virtual void setLease(byte lease, byte* __macAddress, long expires = 0, byte status = DHCP_LEASE_AVAIL,
+                        unsigned long clientId = 0) override;
   byte getLease(byte* __macAddress);
-  byte getNewLease();
+  virtual byte getLease(byte* __macAddress, unsigned long clientId) override;
+  virtual byte getNewLease(byte pool = LOCAL_SUBNET, const byte* __macAddress = nullptr) override;
+  virtual bool leaseAvailable(byte lease) override;
+  virtual byte getLeaseByIPAddress(const byte* __ipAddress) override;
   void swapLease(byte lease1, byte lease2);
-  void deleteLease(byte lease);
+  virtual void deleteLease(byte lease) override;
+  virtual void releaseLease(byte lease) override;
+  virtual void declineLease(byte lease, unsigned long least = 0) override;
+  bool quarantinedLease(byte lease, long timeMs);
 
-  byte* getLeaseMACAddress(byte lease);
-  bool getLeaseIPAddress(byte lease, byte* ipAddress);
+  virtual byte* getLeaseMACAddress(byte lease) override;
+  virtual bool getLeaseIPAddress(byte lease, byte* ipAddress) override;
 
   void setIgnore(byte lease, bool ignore);
   bool ignoreLease(byte lease);
 
-  byte getLeaseStatus(byte lease);
+  virtual byte getLeaseStatus(byte lease) override;
 
-  String leaseStatusString(long status);
+  const char* leaseStatusString(long status);
+  char* leaseExpiresString(byte lease, long timeMs, char* buffer, int size);
 
-  bool getLeaseExpired(byte lease, long timeMs);
-  long getLeaseExpiresSec(byte lease, long timeMs);
+  virtual bool getLeaseExpired(byte lease, long timeMs) override;
+  virtual long getLeaseExpiresSec(byte lease, long timeMs) override;
 
   /* Terminal Commands */
   void leaseTime(OutputInterface* terminal);
@@ -107,10 +372,93 @@ public:
   void removeLease(OutputInterface* terminal);
   void startAddress(OutputInterface* terminal);
   void leaseNum(OutputInterface* terminal);
+  void showDrops(OutputInterface* terminal);
+  void rapidCommit(OutputInterface* terminal);
+  void declineTime(OutputInterface* terminal);
+  void relaySubnet(OutputInterface* terminal);
+  void addressRange(OutputInterface* terminal);
+  void reserveAddress(OutputInterface* terminal);
+  void addressHistory(OutputInterface* terminal);
+  void allocationMode(OutputInterface* terminal);
+  void bootOptions(OutputInterface* terminal);
+  void conflictProbe(OutputInterface* terminal);
+  void relayPort(OutputInterface* terminal);
+  void classProfile(OutputInterface* terminal);
+  void leaseQueryRequesters(OutputInterface* terminal);
+#ifdef DHCP_ALLOC_TRACE
+  void allocReport(OutputInterface* terminal);
+#endif
+
+  virtual DropStats* getDropStats() override { return &dropStats; }
+  DropStats dropStats = {};
+  ReplyStats replyStats = {};
+  ProbeStats probeStats = {};
+  SweepStats sweepStats = {};
+  DDNSQueue ddnsQueue;
+  ArpProbe arpProbe; // shared by the conflict probe and the lease sweep, one address at a time
 
 private:
+  int receivePacket(PacketSlot* slot, int packetSize);
+  void sendReply(DHCPReply* reply);
+
+  // Conflict probe: DISCOVERs for new addresses wait here while the address is ARPed, one at a time
+  ProbeTransaction probes[DHCP_PROBES];
+  void holdForProbe(const PacketSlot* slot, byte lease, byte attempts);
+  void finishProbe(ProbeTransaction* probe, bool conflict);
+  void runProbes();
+
+  // ARP sweep: silent sweeps in a row for each bound lease, or SWEEP_MARKED once it has been expired early
+  byte sweepMissed[LEASESNUM];
+
+  // Free-address index: one doubly linked list of unbound slots per pool, so allocation is O(1)
+#define FREE_UNLINKED 0xFE
+  byte leasePool[LEASESNUM];
+  byte freeNext[LEASESNUM];
+  byte freePrev[LEASESNUM];
+  byte freeHead[DHCP_POOLS];
+  byte freeTail[DHCP_POOLS];
+  bool freeLease(byte lease, long timeMs);
+  void linkFree(byte lease, bool ordered);
+  void unlinkFree(byte lease);
+  void updateFreeIndex(byte lease);
+  int findReservation(const byte* __macAddress, bool* found);
+  byte reclaimLease(byte pool);
+
+  // Client-id index: leases chained per hash bucket, so a client-id lookup is O(1)
+  byte clientIdHead[CLIENT_ID_BUCKETS];
+  byte clientIdNext[LEASESNUM];
+  void indexClientId(byte lease);
+  void unindexClientId(byte lease);
+
+  // MAC index: the same, keyed by the bound hardware address
+  byte macHead[MAC_BUCKETS];
+  byte macNext[LEASESNUM];
+  void indexMAC(byte lease);
+  void unindexMAC(byte lease);
+
+  // Port index: configured ports chained per hash bucket of their circuit id
+  byte portHead[PORT_BUCKETS];
+  byte portNext[DHCP_PORTS];
+
+  // Vendor class trie: the option 60 prefixes of the ranges, compiled whenever the ranges change
+  ClassTrieNode classTrie[CLASS_TRIE_NODES];
+  byte classTrieSize;
+
+  // Host name arena: option 12 names in fixed slots, reused as leases come and go, chained per hash bucket
+  char hostNames[HOSTNAME_SLOTS][HOSTNAME_SIZE];
+  unsigned long hostNameHash[HOSTNAME_SLOTS];
+  byte hostNameLease[HOSTNAME_SLOTS];
+  byte hostNameNext[HOSTNAME_SLOTS]; // bucket chain, or the free list for an unused slot
+  bool hostNamePublished[HOSTNAME_SLOTS]; // registered through DDNS
+  byte hostNameHead[HOSTNAME_BUCKETS];
+  byte hostNameFree;
+  byte leaseHostName[LEASESNUM];
+  void queueDDNS(byte op, byte lease);
+
   EthernetUDP Udp;
-  IPAddress* broadcast;
+  PacketRing packetRing;
+  DHCPEngineConfig engineConfig;
+  DHCPEngine engine;
   const char* domainName = "testsite.net";
   byte broadcastAddress[4];
   unsigned char* ipAddress = nullptr;
@@ -0,0 +1,76 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+// Network boot is configured per range, so PXE clients are steered by their vendor class (PXEClient)
+// or MAC OUI like any other class of client
+bool DHCPServer::getPoolBoot(byte pool, BootConfig* boot) {
+  if ((pool < RANGE_POOL(0)) || (pool >= DHCP_POOLS)) return false;
+  const BootConfig* config = &memory.mem.boot[pool - RANGE_POOL(0)];
+  if (config->bootFile[0] == '\0') return false;
+  memcpy(boot, config, sizeof(BootConfig));
+  if (zeroAddress(boot->nextServer) && ipAddress) memcpy(boot->nextServer, ipAddress, 4);
+  return true;
+}
+
+// Whether any enabled range boots from this server, which is when the TFTP task has to listen
+bool DHCPServer::localBootWanted() {
+  for (byte i = 0; i < DHCP_RANGES; i++) {
+    const BootConfig* config = &memory.mem.boot[i];
+    if ((memory.mem.ranges[i].leaseNum == 0) || (config->bootFile[0] == '\0')) continue;
+    if (zeroAddress(config->nextServer) || (ipAddress && (memcmp(config->nextServer, ipAddress, 4) == 0)))
+      return true;
+  }
+  return false;
+}
+
+bool DHCPServer::setBootConfig(byte range, const BootConfig* boot) {
+  if (range >= DHCP_RANGES) return false;
+  memcpy(&memory.mem.boot[range], boot, sizeof(BootConfig));
+  return true;
+}
+
+void DHCPServer::bootOptions(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    AsciiTable table(terminal);
+    char index[4];
+    char server[20];
+    char file[sizeof(BootConfig::bootFile) + 1];
+    table.addColumn(Normal, "Range", 7);
+    table.addColumn(Green, "Next Server", 18);
+    table.addColumn(Cyan, "Boot File", 40);
+    table.printHeader();
+    for (byte i = 0; i < DHCP_RANGES; i++) {
+      BootConfig* config = &memory.mem.boot[i];
+      snprintf(index, sizeof(index), "%d", i);
+      if (zeroAddress(config->nextServer))
+        snprintf(server, sizeof(server), "This Server");
+      else
+        getIPString(config->nextServer, server, sizeof(server));
+      snprintf(file, sizeof(file), "%.*s", (int) sizeof(config->bootFile), config->bootFile);
+      table.printData(index, server, (config->bootFile[0]) ? file : "Disabled");
+    }
+    table.printDone("Network Boot");
+    terminal->prompt();
+    return;
+  }
+
+  bool success = false;
+  int index = atoi(value);
+  BootConfig config;
+  memset(&config, 0, sizeof(config));
+  char* server = terminal->readParameter();
+  char* file = terminal->readParameter();
+  if ((server != NULL) && (strcmp(server, "off") == 0)) {
+    success = setBootConfig(index, &config);
+  } else if ((server != NULL) && (file != NULL) &&
+             ((strcmp(server, "self") == 0) || parseIPAddress(server, config.nextServer))) {
+    strncpy(config.bootFile, file, sizeof(config.bootFile));
+    success = setBootConfig(index, &config);
+    if (!success) terminal->println(ERROR, "Range index is invalid");
+  } else
+    terminal->println(ERROR, "Usage: boot [n] [next-server|self] [file] | boot [n] off");
+  if (success) setInternal(true);
+  terminal->println((success) ? PASSED : FAILED, "Change Network Boot Complete");
+  terminal->prompt();
+}
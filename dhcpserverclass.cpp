@@ -0,0 +1,133 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+// Compiles the vendor class prefixes of the enabled ranges into a trie, sharing common prefixes, so a
+// vendor class is classified in one walk down it however many ranges there are
+void DHCPServer::rebuildClassTrie() {
+  memset(classTrie, 0, sizeof(classTrie));
+  classTrieSize = 1; // the root
+  for (byte i = 0; i < DHCP_RANGES; i++) {
+    RangeConfig* range = &memory.mem.ranges[i];
+    if ((range->leaseNum == 0) || (range->matchType != RANGE_MATCH_VENDOR)) continue;
+    int length = strnlen(range->vendorClass, sizeof(range->vendorClass));
+    if (length == 0) continue;
+    byte node = 0;
+    for (int j = 0; j < length; j++) {
+      byte child = classTrie[node].child;
+      while ((child != 0) && (classTrie[child].label != range->vendorClass[j])) child = classTrie[child].sibling;
+      if (child == 0) {
+        if (classTrieSize >= CLASS_TRIE_NODES) return;
+        child = classTrieSize++;
+        classTrie[child].label = range->vendorClass[j];
+        classTrie[child].sibling = classTrie[node].child;
+        classTrie[node].child = child;
+      }
+      node = child;
+    }
+    classTrie[node].ranges |= 1 << i;
+  }
+}
+
+// Ranges whose prefix starts the vendor class, as a bit per range
+byte DHCPServer::matchVendorClass(const byte* vendorClass, int length) {
+  byte ranges = 0;
+  byte node = 0;
+  for (int i = 0; i < length; i++) {
+    byte child = classTrie[node].child;
+    while ((child != 0) && (classTrie[child].label != (char) vendorClass[i])) child = classTrie[child].sibling;
+    if (child == 0) break;
+    node = child;
+    ranges |= classTrie[node].ranges;
+  }
+  return ranges;
+}
+
+void DHCPServer::getPoolProfile(byte pool, ClassProfile* profile) {
+  if ((pool >= RANGE_POOL(0)) && (pool < DHCP_POOLS))
+    memcpy(profile, &memory.mem.profiles[pool - RANGE_POOL(0)], sizeof(ClassProfile));
+  else
+    memset(profile, 0, sizeof(ClassProfile));
+}
+
+bool DHCPServer::setClassProfile(byte range, const ClassProfile* profile) {
+  if (range >= DHCP_RANGES) return false;
+  memcpy(&memory.mem.profiles[range], profile, sizeof(ClassProfile));
+  return true;
+}
+
+static char* profileString(byte bits, char* buffer, int size) {
+  int loc = 0;
+  buffer[0] = '\0';
+  for (byte i = 0; i < PROFILE_OPTIONS; i++)
+    if (bits & (1 << i))
+      loc += snprintf(buffer + loc, size - loc, "%s%d", (loc) ? "," : "", DHCPServer::profileOption(1 << i));
+  if (loc == 0) snprintf(buffer, size, "-");
+  return buffer;
+}
+
+// Comma separated option codes, e.g. 3,6,15; only the options a profile can carry are accepted
+static bool parseProfile(char* text, byte* bits) {
+  *bits = 0;
+  for (char* code = strtok(text, ","); code != NULL; code = strtok(NULL, ",")) {
+    byte bit = DHCPServer::profileBit(atoi(code));
+    if (bit == 0) return false;
+    *bits |= bit;
+  }
+  return true;
+}
+
+void DHCPServer::classProfile(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    AsciiTable table(terminal);
+    char index[4];
+    char match[20];
+    char lease[12];
+    char omit[24];
+    char send[24];
+    table.addColumn(Normal, "Range", 7);
+    table.addColumn(Green, "Class", 20);
+    table.addColumn(Yellow, "Lease(s)", 12);
+    table.addColumn(Cyan, "Omit", 22);
+    table.addColumn(Cyan, "Send", 22);
+    table.printHeader();
+    for (byte i = 0; i < DHCP_RANGES; i++) {
+      RangeConfig* config = &memory.mem.ranges[i];
+      ClassProfile* profile = &memory.mem.profiles[i];
+      snprintf(index, sizeof(index), "%d", i);
+      if (config->matchType == RANGE_MATCH_OUI)
+        snprintf(match, sizeof(match), "OUI %02X:%02X:%02X", config->oui[0], config->oui[1], config->oui[2]);
+      else if (config->matchType == RANGE_MATCH_VENDOR)
+        snprintf(match, sizeof(match), "%.*s", (int) sizeof(config->vendorClass), config->vendorClass);
+      else
+        snprintf(match, sizeof(match), "None");
+      snprintf(lease, sizeof(lease), "%lu", getPoolLeaseTime(RANGE_POOL(i)));
+      table.printData(index, match, lease, profileString(profile->omit, omit, sizeof(omit)),
+                      profileString(profile->send, send, sizeof(send)));
+    }
+    table.printDone("Client Classes");
+    terminal->prompt();
+    return;
+  }
+
+  bool success = false;
+  int index = atoi(value);
+  char* action = terminal->readParameter();
+  char* codes = terminal->readParameter();
+  ClassProfile profile;
+  if ((index >= 0) && (index < DHCP_RANGES)) memcpy(&profile, &memory.mem.profiles[index], sizeof(profile));
+  if ((action != NULL) && (strcmp(action, "off") == 0)) {
+    memset(&profile, 0, sizeof(profile));
+    success = setClassProfile(index, &profile);
+  } else if ((action != NULL) && (codes != NULL) && (strcmp(action, "omit") == 0) &&
+             parseProfile(codes, &profile.omit)) {
+    success = setClassProfile(index, &profile);
+  } else if ((action != NULL) && (codes != NULL) && (strcmp(action, "send") == 0) &&
+             parseProfile(codes, &profile.send)) {
+    success = setClassProfile(index, &profile);
+  } else
+    terminal->println(ERROR, "Usage: profile [n] [omit|send] [1,3,6,7,15,66,67] | profile [n] off");
+  if (success) setInternal(true);
+  terminal->println((success) ? PASSED : FAILED, "Change Client Class Complete");
+  terminal->prompt();
+}
@@ -0,0 +1,75 @@
+#include "dhcpserver.h"
+
+// FNV-1a over the option 61 payload. Only the hash is kept in the lease table; 0 is reserved for a
+// lease bound by chaddr alone.
+unsigned long DHCPServer::clientIdHash(const byte* clientId, int length) {
+  uint32_t hash = fnv1a(clientId, length);
+  return (hash == 0) ? 1 : hash;
+}
+
+static byte clientIdBucket(unsigned long clientId) {
+  return (clientId ^ (clientId >> 16)) & (CLIENT_ID_BUCKETS - 1);
+}
+
+byte DHCPServer::getLeaseByClientId(unsigned long clientId) {
+  if (clientId == 0) return INVALID_LEASE;
+  for (byte lease = clientIdHead[clientIdBucket(clientId)]; lease != INVALID_LEASE; lease = clientIdNext[lease])
+    if (memory.mem.leaseClientId[lease] == clientId) return lease;
+  return INVALID_LEASE;
+}
+
+void DHCPServer::indexClientId(byte lease) {
+  unsigned long clientId = memory.mem.leaseClientId[lease];
+  if (clientId == 0) return;
+  byte bucket = clientIdBucket(clientId);
+  clientIdNext[lease] = clientIdHead[bucket];
+  clientIdHead[bucket] = lease;
+}
+
+void DHCPServer::unindexClientId(byte lease) {
+  unsigned long clientId = memory.mem.leaseClientId[lease];
+  if (clientId == 0) return;
+  byte* link = &clientIdHead[clientIdBucket(clientId)];
+  while ((*link != INVALID_LEASE) && (*link != lease)) link = &clientIdNext[*link];
+  if (*link == lease) *link = clientIdNext[lease];
+  clientIdNext[lease] = INVALID_LEASE;
+}
+
+// The low bytes of a MAC address are the NIC specific part, already spread out by the vendor
+static byte macBucket(const byte* __macAddress) {
+  return (__macAddress[3] ^ __macAddress[4] ^ __macAddress[5]) & (MAC_BUCKETS - 1);
+}
+
+byte DHCPServer::getLeaseByMAC(const byte* __macAddress) {
+  for (byte lease = macHead[macBucket(__macAddress)]; lease != INVALID_LEASE; lease = macNext[lease])
+    if (memcmp(memory.mem.leasesMac[lease].macAddress, __macAddress, 6) == 0) return lease;
+  return INVALID_LEASE;
+}
+
+void DHCPServer::indexMAC(byte lease) {
+  if (!validLease(lease)) return;
+  byte bucket = macBucket(memory.mem.leasesMac[lease].macAddress);
+  macNext[lease] = macHead[bucket];
+  macHead[bucket] = lease;
+}
+
+void DHCPServer::unindexMAC(byte lease) {
+  if (!validLease(lease)) return;
+  byte* link = &macHead[macBucket(memory.mem.leasesMac[lease].macAddress)];
+  while ((*link != INVALID_LEASE) && (*link != lease)) link = &macNext[*link];
+  if (*link == lease) *link = macNext[lease];
+  macNext[lease] = INVALID_LEASE;
+}
+
+// Both indexes, since they are keyed by what is in the lease table
+void DHCPServer::rebuildClientIdIndex() {
+  memset(clientIdHead, INVALID_LEASE, sizeof(clientIdHead));
+  memset(clientIdNext, INVALID_LEASE, sizeof(clientIdNext));
+  memset(macHead, INVALID_LEASE, sizeof(macHead));
+  memset(macNext, INVALID_LEASE, sizeof(macNext));
+  for (byte lease = 0; lease < leaseCount(); lease++) {
+    if (!validLease(lease)) continue;
+    indexClientId(lease);
+    indexMAC(lease);
+  }
+}
@@ -0,0 +1,117 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+static const byte dhcpMagic[4] = {0x63, 0x82, 0x53, 0x63};
+
+// Reads a datagram into the slot in two bulk reads, the fixed header and then the option area, so
+// the W5500 sees at most two SPI bursts per datagram. The header alone can reject a datagram before
+// the options are read; the options are then checked in RAM up to the message type (and the server
+// identifier where one is expected).
+int DHCPServer::receivePacket(PacketSlot* slot, int packetSize) {
+  byte* buffer = slot->buffer;
+  RIP_MSG* packet = (RIP_MSG*) buffer;
+  int limit = (packetSize < DHCP_MESSAGE_SIZE) ? packetSize : DHCP_MESSAGE_SIZE;
+
+  if ((limit < DHCP_OPTIONS_OFFSET + 3) || (Udp.read(buffer, DHCP_OPTIONS_OFFSET) < DHCP_OPTIONS_OFFSET)) {
+    dropStats.runt++;
+    return 0;
+  }
+  if (packet->op != DHCP_BOOTREQUEST) {
+    dropStats.notRequest++;
+    return 0;
+  }
+  // a leasequery by address leaves the hardware fields zero (RFC 4388)
+  bool noHardware = (packet->htype == 0) && (packet->hlen == 0);
+  if (((packet->htype != DHCP_HTYPE_ETHERNET) || (packet->hlen != DHCP_HLEN_ETHERNET)) && !noHardware) {
+    dropStats.badHardware++;
+    return 0;
+  }
+  if (memcmp(packet->magic, dhcpMagic, sizeof(dhcpMagic)) != 0) {
+    dropStats.badCookie++;
+    return 0;
+  }
+
+  int read = Udp.read(buffer + DHCP_OPTIONS_OFFSET, limit - DHCP_OPTIONS_OFFSET);
+  int end = DHCP_OPTIONS_OFFSET + ((read > 0) ? read : 0);
+  int loc = DHCP_OPTIONS_OFFSET;
+  byte messageType = 0;
+  bool serverChecked = false;
+  while (loc < end) {
+    byte code = buffer[loc++];
+    if (code == dhcpPadOption) continue;
+    if (code == dhcpEndOption) break;
+
+    if (loc >= end) {
+      dropStats.malformed++;
+      return 0;
+    }
+    byte length = buffer[loc++];
+    if (loc + length > end) {
+      dropStats.malformed++;
+      return 0;
+    }
+
+    if ((code == dhcpMessageType) && (length == 1)) {
+      messageType = buffer[loc];
+      if ((messageType != DHCP_DISCOVER) && (messageType != DHCP_REQUEST) && (messageType != DHCP_DECLINE) &&
+          (messageType != DHCP_RELEASE) && (messageType != DHCP_INFORM) && (messageType != DHCP_LEASEQUERY)) {
+        dropStats.badType++;
+        return 0;
+      }
+      if (noHardware && (messageType != DHCP_LEASEQUERY)) {
+        dropStats.badHardware++;
+        return 0;
+      }
+    } else if ((code == dhcpServerIdentifier) && (length == 4)) {
+      if (memcmp(buffer + loc, ipAddress, 4) != 0) {
+        dropStats.otherServer++;
+        return 0;
+      }
+      serverChecked = true;
+    }
+    loc += length;
+
+    // only REQUEST, DECLINE and RELEASE carry a server identifier worth waiting for
+    if (messageType && (serverChecked || (messageType == DHCP_DISCOVER) || (messageType == DHCP_INFORM) ||
+                        (messageType == DHCP_LEASEQUERY)))
+      break;
+  }
+
+  if (messageType == 0) {
+    dropStats.noMessageType++;
+    return 0;
+  }
+  return end;
+}
+
+void DHCPServer::showDrops(OutputInterface* terminal) {
+  AsciiTable table(terminal);
+  table.addColumn(Normal, "Reason", 20);
+  table.addColumn(Yellow, "Dropped", 12);
+  table.printHeader();
+  char buffer[12];
+  auto row = [&](const char* reason, unsigned long count) { table.printData(reason, ultoa(count, buffer, 10)); };
+  row("Runt", dropStats.runt);
+  row("Not Request", dropStats.notRequest);
+  row("Bad Hardware", dropStats.badHardware);
+  row("Bad Cookie", dropStats.badCookie);
+  row("Malformed", dropStats.malformed);
+  row("No Message Type", dropStats.noMessageType);
+  row("Bad Message Type", dropStats.badType);
+  row("Other Server", dropStats.otherServer);
+  row("Untrusted Query", dropStats.untrustedQuery);
+  table.printDone("Receive Filter");
+
+  // measured around sendReply, so the gather list can be judged against the SPI time it was meant to save
+  AsciiTable sendTable(terminal);
+  sendTable.addColumn(Normal, "Replies", 20);
+  sendTable.addColumn(Yellow, "Value", 12);
+  sendTable.printHeader();
+  auto sendRow = [&](const char* name, unsigned long value) { sendTable.printData(name, ultoa(value, buffer, 10)); };
+  sendRow("Sent", replyStats.replies);
+  sendRow("Bytes", replyStats.bytes);
+  sendRow("Average (us)", (replyStats.replies) ? replyStats.micros / replyStats.replies : 0);
+  sendRow("Worst (us)", replyStats.worstMicros);
+  sendTable.printDone("Reply Transmit");
+  terminal->prompt();
+}
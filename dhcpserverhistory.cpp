@@ -0,0 +1,85 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+static const byte blankMac[6] = {0, 0, 0, 0, 0, 0};
+
+// Records the address a departing client was holding: on release, expiry and reclaim, never for the bulk
+// deletes of configuration changes. Each MAC address keeps one entry; new clients overwrite the oldest
+// entry once the table is full.
+void DHCPServer::rememberLease(byte lease) {
+  byte* mac = getLeaseMACAddress(lease);
+  if (memcmp(mac, blankMac, 6) == 0) return;
+
+  GhostEntry* entry = nullptr;
+  for (byte i = 0; i < DHCP_GHOSTS; i++)
+    if (memcmp(memory.mem.ghosts[i].macAddress, mac, 6) == 0) entry = &memory.mem.ghosts[i];
+  if (entry == nullptr) {
+    if (memory.mem.ghostNext >= DHCP_GHOSTS) memory.mem.ghostNext = 0;
+    entry = &memory.mem.ghosts[memory.mem.ghostNext];
+    memory.mem.ghostNext = (memory.mem.ghostNext + 1) % DHCP_GHOSTS;
+  }
+  memcpy(entry->macAddress, mac, 6);
+  getLeaseIPAddress(lease, entry->ipAddress);
+}
+
+const byte* DHCPServer::getRememberedAddress(const byte* __macAddress) {
+  if (memcmp(__macAddress, blankMac, 6) == 0) return nullptr;
+  for (byte i = 0; i < DHCP_GHOSTS; i++)
+    if (memcmp(memory.mem.ghosts[i].macAddress, __macAddress, 6) == 0) return memory.mem.ghosts[i].ipAddress;
+  return nullptr;
+}
+
+void DHCPServer::clearHistory() {
+  memset(memory.mem.ghosts, 0, sizeof(memory.mem.ghosts));
+  memory.mem.ghostNext = 0;
+}
+
+// With an empty free list, the lease that expired longest ago is taken back. Its owner stays in the
+// address history, so it gets the address again if it returns before someone else needs it.
+byte DHCPServer::reclaimLease(byte pool) {
+  long currTime = millis();
+  byte oldest = INVALID_LEASE;
+  for (byte lease = 0; lease < leaseCount(); lease++) {
+    if ((leasePool[lease] != pool) || !validLease(lease) || !getLeaseExpired(lease, currTime)) continue;
+    if ((oldest == INVALID_LEASE) || (leaseStatus[lease].expires < leaseStatus[oldest].expires)) oldest = lease;
+  }
+  if ((oldest != INVALID_LEASE) && (sweepMissed[oldest] == SWEEP_MARKED)) sweepStats.reclaimed++;
+  if (oldest != INVALID_LEASE) {
+    rememberLease(oldest);
+    deleteLease(oldest);
+  }
+  return oldest;
+}
+
+void DHCPServer::addressHistory(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    AsciiTable table(terminal);
+    char macBuffer[20];
+    char ipBuffer[20];
+    terminal->print(INFO, "Persistent: ");
+    terminal->println(INFO, (memory.mem.ghostPersist) ? "Enabled" : "Disabled");
+    table.addColumn(Green, "MAC Address", 19);
+    table.addColumn(Normal, "Last IpAddress", 17);
+    table.printHeader();
+    for (byte i = 0; i < DHCP_GHOSTS; i++) {
+      if (memcmp(memory.mem.ghosts[i].macAddress, blankMac, 6) == 0) continue;
+      table.printData(getMacString(memory.mem.ghosts[i].macAddress, macBuffer, sizeof(macBuffer)),
+                      getIPString(memory.mem.ghosts[i].ipAddress, ipBuffer, sizeof(ipBuffer)));
+    }
+    table.printDone("Address History");
+  } else if (strcmp(value, "on") == 0) {
+    memory.mem.ghostPersist = 1;
+    setInternal(true);
+    terminal->println(PASSED, "Address History Persistence Enabled");
+  } else if (strcmp(value, "off") == 0) {
+    memory.mem.ghostPersist = 0;
+    setInternal(true);
+    terminal->println(PASSED, "Address History Persistence Disabled");
+  } else if (strcmp(value, "clear") == 0) {
+    clearHistory();
+    terminal->println(PASSED, "Address History Cleared");
+  } else
+    terminal->println(ERROR, "Parameter must be on, off or clear");
+  terminal->prompt();
+}
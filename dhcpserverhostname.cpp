@@ -0,0 +1,117 @@
+#include "dhcpserver.h"
+
+// Reduces option 12 to a lower case DNS label: the name ends at the first dot. Only letters, digits and
+// inner hyphens make a label (RFC 1123); anything else is rejected rather than rewritten, since "a_b"
+// stripped to "ab" would answer for another host. Returns the label length, or -1 when it is not one.
+static int normalizeHostName(const char* name, int length, char* label) {
+  int size = 0;
+  for (int i = 0; (i < length) && (name[i] != '.') && (name[i] != '\0'); i++) {
+    char c = name[i];
+    if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+    if (!(((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (c == '-'))) return -1;
+    if (size >= HOSTNAME_SIZE - 1) return -1;
+    label[size++] = c;
+  }
+  if ((size > 0) && ((label[0] == '-') || (label[size - 1] == '-'))) return -1;
+  label[size] = '\0';
+  return size;
+}
+
+static unsigned long hostNameHashOf(const char* label) {
+  return fnv1a((const byte*) label, strlen(label));
+}
+
+static byte hostNameBucket(unsigned long hash) {
+  return (hash ^ (hash >> 16)) & (HOSTNAME_BUCKETS - 1);
+}
+
+void DHCPServer::resetHostNames() {
+  memset(hostNames, 0, sizeof(hostNames));
+  memset(hostNameHead, INVALID_SLOT, sizeof(hostNameHead));
+  memset(hostNameLease, INVALID_LEASE, sizeof(hostNameLease));
+  memset(hostNamePublished, 0, sizeof(hostNamePublished));
+  memset(leaseHostName, INVALID_SLOT, sizeof(leaseHostName));
+  for (byte slot = 0; slot < HOSTNAME_SLOTS; slot++) hostNameNext[slot] = slot + 1;
+  hostNameNext[HOSTNAME_SLOTS - 1] = INVALID_SLOT;
+  hostNameFree = 0;
+}
+
+// A name held by another lease moves to the newest holder. Names that are not a valid label are not
+// stored. There is a slot for every lease, so a valid name always finds one. A published name is also
+// registered through DDNS.
+bool DHCPServer::setHostName(byte lease, const char* name, int length, bool publish) {
+  char label[HOSTNAME_SIZE];
+  publish = publish && ddnsEnabled();
+  if (!validLeaseNumber(lease)) return false;
+  if (normalizeHostName(name, length, label) <= 0) {
+    clearHostName(lease);
+    return false;
+  }
+  if ((strcmp(getHostName(lease), label) == 0) && (hostNamePublished[leaseHostName[lease]] == publish)) return true;
+
+  clearHostName(lease);
+  byte owner = getLeaseByHostName(label, strlen(label));
+  if (owner != INVALID_LEASE) clearHostName(owner);
+  byte slot = hostNameFree;
+  if (slot == INVALID_SLOT) return false;
+  hostNameFree = hostNameNext[slot];
+
+  strcpy(hostNames[slot], label);
+  hostNameHash[slot] = hostNameHashOf(label);
+  hostNameLease[slot] = lease;
+  leaseHostName[lease] = slot;
+  byte bucket = hostNameBucket(hostNameHash[slot]);
+  hostNameNext[slot] = hostNameHead[bucket];
+  hostNameHead[bucket] = slot;
+  hostNamePublished[slot] = publish;
+  if (hostNamePublished[slot]) queueDDNS(DDNS_ADD, lease);
+  return true;
+}
+
+void DHCPServer::clearHostName(byte lease) {
+  if ((lease >= LEASESNUM) || (leaseHostName[lease] == INVALID_SLOT)) return;
+  byte slot = leaseHostName[lease];
+  if (hostNamePublished[slot]) queueDDNS(DDNS_DELETE, lease);
+  byte* link = &hostNameHead[hostNameBucket(hostNameHash[slot])];
+  while ((*link != INVALID_SLOT) && (*link != slot)) link = &hostNameNext[*link];
+  if (*link == slot) *link = hostNameNext[slot];
+
+  hostNames[slot][0] = '\0';
+  hostNameLease[slot] = INVALID_LEASE;
+  hostNamePublished[slot] = false;
+  hostNameNext[slot] = hostNameFree;
+  hostNameFree = slot;
+  leaseHostName[lease] = INVALID_SLOT;
+}
+
+const char* DHCPServer::getHostName(byte lease) {
+  if ((lease >= LEASESNUM) || (leaseHostName[lease] == INVALID_SLOT)) return "";
+  return hostNames[leaseHostName[lease]];
+}
+
+byte DHCPServer::getLeaseByHostName(const char* name, int length) {
+  char label[HOSTNAME_SIZE];
+  if (normalizeHostName(name, length, label) <= 0) return INVALID_LEASE;
+  unsigned long hash = hostNameHashOf(label);
+  for (byte slot = hostNameHead[hostNameBucket(hash)]; slot != INVALID_SLOT; slot = hostNameNext[slot])
+    if ((hostNameHash[slot] == hash) && (strcmp(hostNames[slot], label) == 0)) return hostNameLease[slot];
+  return INVALID_LEASE;
+}
+
+// Names of leases that ran out are dropped, which withdraws their DNS records
+void DHCPServer::expireHostNames(long timeMs) {
+  for (byte lease = 0; lease < leaseCount(); lease++) {
+    if ((leaseHostName[lease] != INVALID_SLOT) &&
+        (!validLease(lease) || (leaseStatus[lease].status != DHCP_LEASE_ACK) || getLeaseExpired(lease, timeMs)))
+      clearHostName(lease);
+  }
+}
+
+void DHCPServer::queueDDNS(byte op, byte lease) {
+  DDNSEvent event;
+  event.op = op;
+  if (!getLeaseIPAddress(lease, event.ipAddress)) return;
+  memcpy(event.macAddress, getLeaseMACAddress(lease), 6);
+  strcpy(event.hostName, getHostName(lease));
+  ddnsQueue.push(&event);
+}
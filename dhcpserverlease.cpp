@@ -2,6 +2,10 @@
 
 static const byte blankMac[6] = {0, 0, 0, 0, 0, 0};
 
+static unsigned long quad2long(const byte* quad) {
+  return ((unsigned long) quad[0] << 24) | ((unsigned long) quad[1] << 16) | ((unsigned long) quad[2] << 8) | quad[3];
+}
+
 static bool blankMAC(byte* mac) {
   if (memcmp(mac, blankMac, 6) == 0)
     return true;
@@ -18,6 +22,24 @@ bool DHCPServer::setLeaseTime(unsigned long time) {
   return true;
 }
 
+// 0 is what an image saved before the setting existed holds, so it reads as the default rather than off
+unsigned long DHCPServer::getDeclineTime() {
+  return (memory.mem.declineTime > 0) ? memory.mem.declineTime : DHCP_DECLINE_TIME;
+}
+
+bool DHCPServer::setDeclineTime(unsigned long time) {
+  memory.mem.declineTime = time;
+  return true;
+}
+
+bool DHCPServer::getRapidCommit() {
+  return memory.mem.rapidCommit != 0;
+}
+
+void DHCPServer::setRapidCommit(bool enable) {
+  memory.mem.rapidCommit = (enable) ? 1 : 0;
+}
+
 bool DHCPServer::validLease(byte lease) {
   bool value = false;
   if (validLeaseNumber(lease)) value = !blankMAC(memory.mem.leasesMac[lease].macAddress);
@@ -27,25 +49,56 @@ bool DHCPServer::validLease(byte lease) {
 bool DHCPServer::validLeaseNumber(byte lease) {
   bool value = false;
 
-  if ((lease != INVALID_LEASE) && (lease < memory.mem.leaseNum)) { value = true; }
+  if ((lease != INVALID_LEASE) && (lease < leaseCount())) { value = true; }
   return value;
 }
 
-void DHCPServer::setLease(byte lease, byte* __macAddress, long expires, byte status) {
+void DHCPServer::setLease(byte lease, byte* __macAddress, long expires, byte status, unsigned long clientId) {
   if (validLeaseNumber(lease)) {
+    unindexClientId(lease);
+    unindexMAC(lease);
+    if (memcmp(memory.mem.leasesMac[lease].macAddress, __macAddress, 6) != 0)
+      clearHostName(lease);
+    else if (sweepMissed[lease] == SWEEP_MARKED)
+      sweepStats.returned++; // the sweep gave up on a client that was still there
+    sweepMissed[lease] = 0;
     memcpy(memory.mem.leasesMac[lease].macAddress, __macAddress, 6);
+    memory.mem.leaseClientId[lease] = clientId;
+    indexClientId(lease);
+    indexMAC(lease);
     leaseStatus[lease].expires = expires;
     leaseStatus[lease].status = status;
+    updateFreeIndex(lease);
+  }
+}
+
+byte DHCPServer::getNewLease(byte pool, const byte* __macAddress) {
+  if (pool >= DHCP_POOLS) return INVALID_LEASE;
+  if (__macAddress) {
+    // a returning client gets its previous address back while nobody else holds it
+    const byte* remembered = getRememberedAddress(__macAddress);
+    byte lease = (remembered) ? getLeaseByIPAddress(remembered) : INVALID_LEASE;
+    if (leaseAvailable(lease) && (leasePool[lease] == pool)) return lease;
   }
+  if (freeHead[pool] != INVALID_LEASE) return freeHead[pool];
+  return reclaimLease(pool);
 }
 
-byte DHCPServer::getNewLease() {
-  byte blank[6] = {0, 0, 0, 0, 0, 0};
-  return getLease(blank);
+byte DHCPServer::getLeaseByIPAddress(const byte* __ipAddress) {
+  for (byte subnet = LOCAL_SUBNET; subnet <= RELAY_SUBNETS; subnet++) {
+    byte base;
+    byte count;
+    byte first[4];
+    if (!getSubnetRange(subnet, &base, &count) || (count == 0)) continue;
+    getLeaseIPAddress(base, first);
+    unsigned long offset = quad2long(__ipAddress) - quad2long(first);
+    if (offset < count) return base + offset;
+  }
+  return INVALID_LEASE;
 }
 
 byte DHCPServer::getLease(byte* __macAddress) {
-  for (byte lease = 0; lease < memory.mem.leaseNum; lease++)
+  for (byte lease = 0; lease < leaseCount(); lease++)
     if (memcmp(memory.mem.leasesMac[lease].macAddress, __macAddress, 6) == 0) return lease;
 
   // Clean up expired leases; need to do after we check for existing leases because of this iOS bug
@@ -53,53 +106,119 @@ byte DHCPServer::getLease(byte* __macAddress) {
   // Don't need to check again AFTER the clean up as for DHCP REQUEST the client should already have the lease
   // and for DHCP DISCOVER we will check once more to assign a new lease
   long currTime = millis();
-  for (byte lease = 0; lease < memory.mem.leaseNum; lease++) {
-    if ((validLease(lease)) && (leaseStatus[lease].expires < currTime)) leaseStatus[lease].status = DHCP_LEASE_AVAIL;
+  for (byte lease = 0; lease < leaseCount(); lease++) {
+    if ((validLease(lease) || (leaseStatus[lease].status == DHCP_LEASE_DECLINED)) &&
+        (leaseStatus[lease].expires < currTime)) {
+      if (leaseStatus[lease].status == DHCP_LEASE_ACK) rememberLease(lease);
+      leaseStatus[lease].status = DHCP_LEASE_AVAIL;
+      updateFreeIndex(lease); // a finished quarantine returns to the pool
+    }
   }
 
   return INVALID_LEASE;
 }
 
+// A client that sends option 61 is bound by it, so a new NIC or dock keeps its address. A binding found
+// by chaddr alone but made under another client-id belongs to a different client.
+byte DHCPServer::getLease(byte* __macAddress, unsigned long clientId) {
+  byte lease = getLeaseByClientId(clientId);
+  if (lease != INVALID_LEASE) return lease;
+  lease = getLease(__macAddress);
+  if (validLeaseNumber(lease) && (clientId != 0) && (memory.mem.leaseClientId[lease] != 0) &&
+      (memory.mem.leaseClientId[lease] != clientId))
+    return INVALID_LEASE;
+  return lease;
+}
+
 void DHCPServer::swapLease(byte lease1, byte lease2) {
   LeaseMac tempMac;
+  unsigned long tempClientId;
   LeaseStatus tempStatus;
 
   if (validLeaseNumber(lease1) && validLeaseNumber(lease2)) {
+    // both clients have to bind again at their new address, which brings their names back
+    clearHostName(lease1);
+    clearHostName(lease2);
+    unindexClientId(lease1);
+    unindexMAC(lease1);
+    unindexClientId(lease2);
+    unindexMAC(lease2);
+
     // Copy lease 1 to temp
     memcpy(&tempMac, &memory.mem.leasesMac[lease1], sizeof(LeaseMac));
+    tempClientId = memory.mem.leaseClientId[lease1];
     memcpy(&tempStatus, &leaseStatus[lease1], sizeof(LeaseStatus));
 
     // Copy lease 2 to lease 1
     memcpy(&memory.mem.leasesMac[lease1], &memory.mem.leasesMac[lease2], sizeof(LeaseMac));
+    memory.mem.leaseClientId[lease1] = memory.mem.leaseClientId[lease2];
     memcpy(&leaseStatus[lease1], &leaseStatus[lease2], sizeof(LeaseStatus));
 
     // Copy temp to lease 2
     memcpy(&memory.mem.leasesMac[lease2], &tempMac, sizeof(LeaseMac));
+    memory.mem.leaseClientId[lease2] = tempClientId;
     memcpy(&leaseStatus[lease2], &tempStatus, sizeof(LeaseStatus));
 
     leaseStatus[lease1].status = DHCP_LEASE_AVAIL;
     leaseStatus[lease2].status = DHCP_LEASE_AVAIL;
+    indexClientId(lease1);
+    indexMAC(lease1);
+    indexClientId(lease2);
+    indexMAC(lease2);
+
+    updateFreeIndex(lease1);
+    updateFreeIndex(lease2);
   }
 }
 
 void DHCPServer::deleteLease(byte lease) {
   if (validLeaseNumber(lease)) {
+    unindexClientId(lease);
+    unindexMAC(lease);
+    clearHostName(lease);
+    sweepMissed[lease] = 0;
     memset(&memory.mem.leasesMac[lease], 0, sizeof(LeaseMac));
+    memory.mem.leaseClientId[lease] = 0;
     memset(&leaseStatus[lease], 0, sizeof(LeaseStatus));
+    updateFreeIndex(lease);
+  }
+}
+
+// DHCPRELEASE: the client is done with the address, so it goes straight back to the pool
+void DHCPServer::releaseLease(byte lease) {
+  if (validLeaseNumber(lease)) rememberLease(lease);
+  deleteLease(lease);
+}
+
+// DHCPDECLINE: the client found the address in use, so keep it out of the pool for a while, and for at
+// least the given number of seconds whatever the decline time is set to
+void DHCPServer::declineLease(byte lease, unsigned long least) {
+  deleteLease(lease);
+  if (validLeaseNumber(lease)) {
+    unsigned long quarantine = (getDeclineTime() > least) ? getDeclineTime() : least;
+    leaseStatus[lease].expires = millis() + (quarantine * 1000);
+    leaseStatus[lease].status = DHCP_LEASE_DECLINED;
+    updateFreeIndex(lease);
   }
 }
 
+bool DHCPServer::quarantinedLease(byte lease, long timeMs) {
+  return (leaseStatus[lease].status == DHCP_LEASE_DECLINED) && (leaseStatus[lease].expires > timeMs);
+}
+
 byte* DHCPServer::getLeaseMACAddress(byte lease) {
   return memory.mem.leasesMac[lease].macAddress;
 }
 
 bool DHCPServer::getLeaseIPAddress(byte lease, byte* __ipAddress) {
-  memcpy(__ipAddress, ipAddress, 4);
-  __ipAddress[0] = __ipAddress[0] & subnetMask[0];
-  __ipAddress[1] = __ipAddress[1] & subnetMask[1];
-  __ipAddress[2] = __ipAddress[2] & subnetMask[2];
-  __ipAddress[3] = __ipAddress[3] & subnetMask[3];
-  __ipAddress[3] += (lease + memory.mem.startAddressNumber) & 0xFF; // lease starts with 1
+  byte subnet = getLeaseSubnet(lease);
+  byte base;
+  byte count;
+  SubnetConfig config;
+  if (!getSubnetRange(subnet, &base, &count)) return false;
+  getSubnetConfig(subnet, &config);
+  unsigned long address = quad2long(config.network) + config.startAddress + (lease - base);
+  for (int k = 0; k < 4; k++) __ipAddress[3 - k] = address >> (k * 8);
   return true;
 }
 
@@ -107,16 +226,12 @@ byte DHCPServer::getLeaseStatus(byte lease) {
   return leaseStatus[lease].status;
 }
 
-String DHCPServer::leaseStatusString(long status) {
-  String string;
-  switch (status) {
-  case DHCP_LEASE_AVAIL: string = "DHCP_LEASE_AVAIL"; break;
-  case DHCP_LEASE_OFFER: string = "DHCP_LEASE_OFFER"; break;
-  case DHCP_LEASE_ACK: string = "DHCP_LEASE_ACK"; break;
+static constexpr const char* leaseStatusNames[] = {"DHCP_LEASE_AVAIL", "DHCP_LEASE_OFFER", "DHCP_LEASE_ACK",
+                                                   "DHCP_LEASE_DECLINED"};
 
-  default: string = "UNKNOWN"; break;
-  }
-  return string;
+const char* DHCPServer::leaseStatusString(long status) {
+  if ((status < 0) || (status >= (long) (sizeof(leaseStatusNames) / sizeof(leaseStatusNames[0])))) return "UNKNOWN";
+  return leaseStatusNames[status];
 }
 
 bool DHCPServer::getLeaseExpired(byte lease, long timeMs) {
@@ -133,3 +248,17 @@ long DHCPServer::getLeaseExpiresSec(byte lease, long timeMs) {
     expiredTime = (timeMs - leaseStatus[lease].expires) / 1000;
   return expiredTime;
 }
+
+char* DHCPServer::leaseExpiresString(byte lease, long timeMs, char* buffer, int size) {
+  int offset = 0;
+  if (size < 3) {
+    if (size > 0) buffer[0] = '\0';
+    return buffer;
+  }
+  if (getLeaseExpired(lease, timeMs)) {
+    buffer[offset++] = '-';
+    buffer[offset++] = ' ';
+  }
+  timeString(getLeaseExpiresSec(lease, timeMs), buffer + offset, size - offset);
+  return buffer;
+}
@@ -4,16 +4,23 @@ void DHCPServer::configure(unsigned char* __ipAddress, unsigned char* __subnetMa
   ipAddress = __ipAddress;
   subnetMask = __subnetMask;
   macAddress = __macAddress;
+  engineConfig.serverIP = ipAddress;
+  engineConfig.domainName = domainName;
   updateBroadcast();
+  resetHostNames();
+  rebuildFreeIndex();
 };
 
 void DHCPServer::initMemory() {
   memset(memory.memoryArray, 0, sizeof(MemoryStruct));
   memset(leaseStatus, 0, sizeof(leaseStatus));
   memory.mem.leaseTime = 86400;
+  memory.mem.declineTime = DHCP_DECLINE_TIME;
   memory.mem.startAddressNumber = 101;
   memory.mem.leaseNum = LEASESNUM;
+  resetHostNames();
   updateBroadcast();
+  rebuildFreeIndex();
 }
 
 void DHCPServer::printData(OutputInterface* terminal) {
@@ -38,6 +45,49 @@ void DHCPServer::printData(OutputInterface* terminal) {
   sb = "Lease Time: ";
   sb + memory.mem.leaseTime;
   terminal->println(INFO, sb.c_str());
+
+  for (byte i = 0; i < RELAY_SUBNETS; i++) {
+    SubnetConfig* subnet = &memory.mem.subnets[i];
+    if (subnet->leaseNum == 0) continue;
+    sb = "Relay Subnet ";
+    sb + (i + 1) + ": ";
+    sb + getIPString(subnet->network, buffer, sizeof(buffer)) + "/";
+    sb + getIPString(subnet->subnetMask, buffer, sizeof(buffer)) + " Leases: ";
+    sb + subnet->leaseNum;
+    terminal->println(INFO, sb.c_str());
+  }
+
+  sb = "Reservations: ";
+  sb + memory.mem.reservationNum;
+  terminal->println(INFO, sb.c_str());
+
+  sb = "Allocation Mode: ";
+  sb + ((memory.mem.allocMode == ALLOC_LRU) ? "LRU" : "Lowest");
+  terminal->println(INFO, sb.c_str());
+
+  sb = "Decline Time: ";
+  sb + getDeclineTime();
+  terminal->println(INFO, sb.c_str());
+
+  sb = "Rapid Commit: ";
+  sb + ((getRapidCommit()) ? "Enabled" : "Disabled");
+  terminal->println(INFO, sb.c_str());
+
+  sb = "Conflict Probe: ";
+  sb + ((getConflictProbe()) ? "Enabled" : "Disabled");
+  terminal->println(INFO, sb.c_str());
+
+  sb = "Lease Sweep Misses: ";
+  sb + memory.mem.sweepMisses;
+  terminal->println(INFO, sb.c_str());
+
+  sb = "DNS Upstream: ";
+  sb + getIPString(memory.mem.dnsUpstream, buffer, sizeof(buffer));
+  terminal->println(INFO, sb.c_str());
+
+  sb = "DDNS Server: ";
+  sb + getIPString(memory.mem.ddnsServer, buffer, sizeof(buffer));
+  terminal->println(INFO, sb.c_str());
 }
 
 JsonDocument DHCPServer::createJson() {
@@ -49,6 +99,73 @@ JsonDocument DHCPServer::createJson() {
   doc["leasetime"] = memory.mem.leaseTime;
   doc["startOctet"] = memory.mem.startAddressNumber;
   doc["lastOctet"] = memory.mem.startAddressNumber + memory.mem.leaseNum - 1;
+  doc["declineTime"] = memory.mem.declineTime;
+  doc["rapidCommit"] = getRapidCommit();
+  doc["conflictProbe"] = getConflictProbe();
+  doc["sweepMisses"] = memory.mem.sweepMisses;
+  doc["historyPersist"] = (memory.mem.ghostPersist != 0);
+  doc["allocMode"] = (memory.mem.allocMode == ALLOC_LRU) ? "lru" : "lowest";
+  doc["dnsUpstream"] = getIPString(memory.mem.dnsUpstream, temp, sizeof(temp));
+  doc["ddnsServer"] = getIPString(memory.mem.ddnsServer, temp, sizeof(temp));
+  JsonArray subnets = doc["subnets"].to<JsonArray>();
+  for (byte i = 0; i < RELAY_SUBNETS; i++) {
+    SubnetConfig* subnet = &memory.mem.subnets[i];
+    JsonObject object = subnets.add<JsonObject>();
+    object["network"] = getIPString(subnet->network, temp, sizeof(temp));
+    object["mask"] = getIPString(subnet->subnetMask, temp, sizeof(temp));
+    object["router"] = getIPString(subnet->router, temp, sizeof(temp));
+    object["dns"] = getIPString(subnet->dns, temp, sizeof(temp));
+    object["start"] = subnet->startAddress;
+    object["num"] = subnet->leaseNum;
+  }
+  JsonArray ranges = doc["ranges"].to<JsonArray>();
+  for (byte i = 0; i < DHCP_RANGES; i++) {
+    RangeConfig* range = &memory.mem.ranges[i];
+    JsonObject object = ranges.add<JsonObject>();
+    object["subnet"] = range->subnet;
+    object["start"] = range->startAddress;
+    object["num"] = range->leaseNum;
+    if (range->matchType == RANGE_MATCH_OUI) {
+      snprintf(temp, sizeof(temp), "%02X:%02X:%02X", range->oui[0], range->oui[1], range->oui[2]);
+      object["oui"] = temp;
+    } else if (range->matchType == RANGE_MATCH_VENDOR) {
+      snprintf(temp, sizeof(temp), "%.*s", (int) sizeof(range->vendorClass), range->vendorClass);
+      object["vendor"] = temp;
+    }
+    object["leasetime"] = range->leaseTime;
+    object["router"] = getIPString(range->router, temp, sizeof(temp));
+    object["dns"] = getIPString(range->dns, temp, sizeof(temp));
+    BootConfig* boot = &memory.mem.boot[i];
+    if (boot->bootFile[0]) {
+      object["nextServer"] = getIPString(boot->nextServer, temp, sizeof(temp));
+      snprintf(temp, sizeof(temp), "%.*s", (int) sizeof(boot->bootFile), boot->bootFile);
+      object["bootFile"] = temp;
+    }
+    ClassProfile* profile = &memory.mem.profiles[i];
+    for (byte bit = 0; bit < PROFILE_OPTIONS; bit++) {
+      if (profile->omit & (1 << bit)) object["omit"].add(profileOption(1 << bit));
+      if (profile->send & (1 << bit)) object["send"].add(profileOption(1 << bit));
+    }
+  }
+  JsonArray reservations = doc["reservations"].to<JsonArray>();
+  for (byte i = 0; (i < memory.mem.reservationNum) && (i < DHCP_RESERVATIONS); i++) {
+    JsonObject object = reservations.add<JsonObject>();
+    object["macAddress"] = getMacString(memory.mem.reservations[i].macAddress, temp, sizeof(temp));
+    object["ipAddress"] = getIPString(memory.mem.reservations[i].ipAddress, temp, sizeof(temp));
+  }
+  JsonArray ports = doc["ports"].to<JsonArray>();
+  for (byte i = 0; i < DHCP_PORTS; i++) {
+    PortConfig* port = &memory.mem.ports[i];
+    JsonObject object = ports.add<JsonObject>();
+    object["circuitId"] = relayIdString(port->circuitId, port->circuitLength, temp, sizeof(temp));
+    object["remoteId"] = relayIdString(port->remoteId, port->remoteLength, temp, sizeof(temp));
+    object["ipAddress"] = getIPString(port->ipAddress, temp, sizeof(temp));
+    if (port->range < DHCP_RANGES) object["range"] = port->range;
+  }
+  JsonArray requesters = doc["leaseQueryRequesters"].to<JsonArray>();
+  for (byte i = 0; i < DHCP_QUERY_REQUESTERS; i++)
+    if (!zeroAddress(memory.mem.queryRequesters[i]))
+      requesters.add(getIPString(memory.mem.queryRequesters[i], temp, sizeof(temp)));
   JsonArray data = doc["dhcptable"].to<JsonArray>();
   {
     JsonObject object = data.add<JsonObject>();
@@ -58,33 +175,154 @@ JsonDocument DHCPServer::createJson() {
     object["stat"] = 2;
     object["status"] = "DHCP Server";
   }
-  for (byte i = 0; i < memory.mem.leaseNum; i++) {
-    if (validLease(i)) {
+  for (byte i = 0; i < leaseCount(); i++) {
+    if (validLease(i) || quarantinedLease(i, current)) {
       getLeaseIPAddress(i, ipAdd);
       JsonObject object = data.add<JsonObject>();
       object["ipAddress"] = getIPString(ipAdd, temp, sizeof(temp));
       object["macAddress"] = getMacString(getLeaseMACAddress(i), temp, sizeof(temp));
-      String expires = "";
-      if (getLeaseExpired(i, current)) expires += "- ";
-      expires += timeString(getLeaseExpiresSec(i, current), temp, sizeof(temp));
-      object["expires"] = expires;
+      object["expires"] = leaseExpiresString(i, current, temp, sizeof(temp));
       object["exp"] = getLeaseExpired(i, current);
       object["stat"] = leaseStatus[i].status;
       object["status"] = leaseStatusString(leaseStatus[i].status);
+      object["hostName"] = getHostName(i);
+      if (memory.mem.leaseClientId[i]) object["clientId"] = memory.mem.leaseClientId[i];
     }
   }
   return doc;
 }
 
 bool DHCPServer::parseJson(JsonDocument& doc) {
+  char temp[32];
   if (!doc["leasetime"].isNull()) { memory.mem.leaseTime = doc["leasetime"]; }
-  if (!doc["startOctet"].isNull()) {
-    byte value = doc["startOctet"];
-    if ((value >= 1) && (value <= 255) && ((value + memory.mem.leaseNum) <= 255)) memory.mem.startAddressNumber = value;
+  if (!doc["declineTime"].isNull()) { memory.mem.declineTime = doc["declineTime"]; }
+  if (!doc["rapidCommit"].isNull()) { setRapidCommit(doc["rapidCommit"].as<bool>()); }
+  if (!doc["conflictProbe"].isNull()) { setConflictProbe(doc["conflictProbe"].as<bool>()); }
+  if (!doc["sweepMisses"].isNull()) {
+    int misses = doc["sweepMisses"].as<int>();
+    if ((misses >= 0) && (misses < SWEEP_MARKED)) setSweepMisses(misses);
+  }
+  if (!doc["allocMode"].isNull()) {
+    const char* mode = doc["allocMode"];
+    if (mode) memory.mem.allocMode = (strcmp(mode, "lru") == 0) ? ALLOC_LRU : ALLOC_LOWEST;
+  }
+  if (!doc["dnsUpstream"].isNull()) {
+    const char* upstream = doc["dnsUpstream"];
+    if (upstream) parseIPAddress(upstream, memory.mem.dnsUpstream);
+  }
+  if (!doc["ddnsServer"].isNull()) {
+    const char* server = doc["ddnsServer"];
+    if (server) parseIPAddress(server, memory.mem.ddnsServer);
+  }
+  if (!doc["historyPersist"].isNull()) { memory.mem.ghostPersist = (doc["historyPersist"].as<bool>()) ? 1 : 0; }
+  if (!doc["startOctet"].isNull() || !doc["lastOctet"].isNull()) {
+    int start = memory.mem.startAddressNumber;
+    int last = start + memory.mem.leaseNum - 1;
+    if (!doc["startOctet"].isNull()) start = doc["startOctet"].as<int>();
+    if (!doc["lastOctet"].isNull()) last = doc["lastOctet"].as<int>();
+    if ((start >= 1) && (last >= start - 1) && (last <= 254)) setLocalRange(start, last - start + 1);
+  }
+  if (!doc["subnets"].isNull()) {
+    JsonArray subnets = doc["subnets"].as<JsonArray>();
+    byte index = LOCAL_SUBNET;
+    for (JsonObject item : subnets) {
+      if (++index > RELAY_SUBNETS) break;
+      SubnetConfig config;
+      memset(&config, 0, sizeof(config));
+      const char* network = item["network"];
+      const char* mask = item["mask"];
+      const char* router = item["router"];
+      const char* dns = item["dns"];
+      if (network) parseIPAddress(network, config.network);
+      if (mask) parseIPAddress(mask, config.subnetMask);
+      if (router) parseIPAddress(router, config.router);
+      if (dns) parseIPAddress(dns, config.dns);
+      if (!item["start"].isNull()) config.startAddress = item["start"];
+      if (!item["num"].isNull()) config.leaseNum = item["num"];
+      setSubnetConfig(index, &config);
+    }
+  }
+  if (!doc["ranges"].isNull()) {
+    JsonArray ranges = doc["ranges"].as<JsonArray>();
+    byte index = 0;
+    for (JsonObject item : ranges) {
+      if (index >= DHCP_RANGES) break;
+      RangeConfig config;
+      memset(&config, 0, sizeof(config));
+      const char* oui = item["oui"];
+      const char* vendor = item["vendor"];
+      const char* router = item["router"];
+      const char* dns = item["dns"];
+      if (!item["subnet"].isNull()) config.subnet = item["subnet"];
+      if (!item["start"].isNull()) config.startAddress = item["start"];
+      if (!item["num"].isNull()) config.leaseNum = item["num"];
+      if (!item["leasetime"].isNull()) config.leaseTime = item["leasetime"];
+      if (oui) {
+        byte mac[6] = {0, 0, 0, 0, 0, 0};
+        snprintf(temp, sizeof(temp), "%s:00:00:00", oui);
+        config.matchType = RANGE_MATCH_OUI;
+        if (parseMacString(temp, mac)) memcpy(config.oui, mac, sizeof(config.oui));
+      } else if (vendor) {
+        config.matchType = RANGE_MATCH_VENDOR;
+        strncpy(config.vendorClass, vendor, sizeof(config.vendorClass));
+      }
+      if (router) parseIPAddress(router, config.router);
+      if (dns) parseIPAddress(dns, config.dns);
+      BootConfig boot;
+      memset(&boot, 0, sizeof(boot));
+      const char* nextServer = item["nextServer"];
+      const char* bootFile = item["bootFile"];
+      if (nextServer) parseIPAddress(nextServer, boot.nextServer);
+      if (bootFile) strncpy(boot.bootFile, bootFile, sizeof(boot.bootFile));
+      setBootConfig(index, &boot);
+      ClassProfile profile;
+      memset(&profile, 0, sizeof(profile));
+      for (JsonVariant code : item["omit"].as<JsonArray>()) profile.omit |= profileBit(code.as<byte>());
+      for (JsonVariant code : item["send"].as<JsonArray>()) profile.send |= profileBit(code.as<byte>());
+      setClassProfile(index, &profile);
+      setRangeConfig(index++, &config);
+    }
   }
-  if (!doc["lastOctet"].isNull()) {
-    byte value = doc["lastOctet"];
-    if ((value >= 1) && (value <= 255)) memory.mem.leaseNum = value - memory.mem.startAddressNumber + 1;
+  if (!doc["leaseQueryRequesters"].isNull()) {
+    memset(memory.mem.queryRequesters, 0, sizeof(memory.mem.queryRequesters));
+    for (JsonVariant item : doc["leaseQueryRequesters"].as<JsonArray>()) {
+      const char* ip = item.as<const char*>();
+      byte address[4];
+      if (ip && parseIPAddress(ip, address)) addQueryRequester(address);
+    }
+  }
+  if (!doc["reservations"].isNull()) {
+    JsonArray reservations = doc["reservations"].as<JsonArray>();
+    memory.mem.reservationNum = 0;
+    memset(memory.mem.reservations, 0, sizeof(memory.mem.reservations));
+    for (JsonObject item : reservations) {
+      if (!item["ipAddress"].isNull() && !item["macAddress"].isNull()) {
+        unsigned char ipBuffer[4];
+        unsigned char macBuffer[6];
+        const char* ip = item["ipAddress"];
+        const char* mac = item["macAddress"];
+        if (parseIPAddress(ip, ipBuffer) && parseMacString(mac, macBuffer)) addReservation(macBuffer, ipBuffer);
+      }
+    }
+  }
+  if (!doc["ports"].isNull()) {
+    JsonArray ports = doc["ports"].as<JsonArray>();
+    byte index = 0;
+    for (JsonObject item : ports) {
+      if (index >= DHCP_PORTS) break;
+      PortConfig config;
+      memset(&config, 0, sizeof(config));
+      config.range = PORT_NO_RANGE;
+      const char* circuitId = item["circuitId"];
+      const char* remoteId = item["remoteId"];
+      const char* address = item["ipAddress"];
+      if (circuitId && circuitId[0]) parseRelayId(circuitId, config.circuitId, &config.circuitLength);
+      if (remoteId && remoteId[0]) parseRelayId(remoteId, config.remoteId, &config.remoteLength);
+      if (address) parseIPAddress(address, config.ipAddress);
+      if (!item["range"].isNull() && (item["range"].as<int>() >= 0) && (item["range"].as<int>() < DHCP_RANGES))
+        config.range = item["range"].as<int>();
+      setPortConfig(index++, &config);
+    }
   }
   if (!doc["moveFrom"].isNull() && !doc["moveTo"].isNull()) {
     byte from = doc["moveFrom"];
@@ -112,14 +350,14 @@ bool DHCPServer::parseJson(JsonDocument& doc) {
         const char* mac = item["macAddress"];
         parseIPAddress(ip, ipBuffer);
         parseMacString(mac, macBuffer);
-        if ((ipBuffer[3] >= memory.mem.startAddressNumber) &&
-            (ipBuffer[3] < (memory.mem.startAddressNumber + memory.mem.leaseNum))) {
-          unsigned int index = ipBuffer[3] - memory.mem.startAddressNumber;
-          setLease(index, macBuffer);
-        }
+        byte index = getLeaseByIPAddress(ipBuffer);
+        unsigned long clientId = 0;
+        if (!item["clientId"].isNull()) clientId = item["clientId"];
+        if (validLeaseNumber(index)) setLease(index, macBuffer, 0, DHCP_LEASE_AVAIL, clientId);
       }
     }
   }
+  rebuildFreeIndex();
   setInternal(true);
   return true;
 }
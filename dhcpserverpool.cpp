@@ -0,0 +1,224 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+// First enabled range in the subnet whose OUI or vendor class prefix matches, else the subnet default. The
+// vendor class is matched against every range at once by one walk down the class trie.
+byte DHCPServer::selectPool(byte subnet, const byte* __macAddress, const byte* vendorClass, int vendorLength) {
+  byte vendorRanges = (vendorClass != nullptr) ? matchVendorClass(vendorClass, vendorLength) : 0;
+  for (byte i = 0; i < DHCP_RANGES; i++) {
+    RangeConfig* range = &memory.mem.ranges[i];
+    if ((range->leaseNum == 0) || (range->subnet != subnet)) continue;
+    if ((vendorRanges & (1 << i)) ||
+        ((range->matchType == RANGE_MATCH_OUI) && (memcmp(range->oui, __macAddress, sizeof(range->oui)) == 0)))
+      return RANGE_POOL(i);
+  }
+  return subnet;
+}
+
+byte DHCPServer::getLeasePool(byte lease) {
+  return (validLeaseNumber(lease)) ? leasePool[lease] : INVALID_POOL;
+}
+
+unsigned long DHCPServer::getPoolLeaseTime(byte pool) {
+  if ((pool >= RANGE_POOL(0)) && (pool < DHCP_POOLS)) {
+    RangeConfig* range = &memory.mem.ranges[pool - RANGE_POOL(0)];
+    if (range->leaseTime > 0) return range->leaseTime;
+  }
+  return memory.mem.leaseTime;
+}
+
+void DHCPServer::getPoolConfig(byte pool, SubnetConfig* config) {
+  if ((pool >= RANGE_POOL(0)) && (pool < DHCP_POOLS)) {
+    RangeConfig* range = &memory.mem.ranges[pool - RANGE_POOL(0)];
+    getSubnetConfig(range->subnet, config);
+    if (!zeroAddress(range->router)) memcpy(config->router, range->router, 4);
+    if (!zeroAddress(range->dns)) memcpy(config->dns, range->dns, 4);
+  } else
+    getSubnetConfig(pool, config);
+}
+
+bool DHCPServer::setRangeConfig(byte range, const RangeConfig* config) {
+  if (range >= DHCP_RANGES) return false;
+  if ((config->leaseNum > 0) && (config->subnet > RELAY_SUBNETS)) return false;
+  memcpy(&memory.mem.ranges[range], config, sizeof(RangeConfig));
+  rebuildFreeIndex();
+  return true;
+}
+
+bool DHCPServer::leaseAvailable(byte lease) {
+  return validLeaseNumber(lease) && (leasePool[lease] != INVALID_POOL) && freeLease(lease, millis());
+}
+
+bool DHCPServer::freeLease(byte lease, long timeMs) {
+  return !validLease(lease) && !quarantinedLease(lease, timeMs);
+}
+
+// Links a free slot into its pool's list, either in address order or behind every other free slot. A pool
+// never spans subnets, so slot order is address order.
+void DHCPServer::linkFree(byte lease, bool ordered) {
+  byte pool = leasePool[lease];
+  if ((pool >= DHCP_POOLS) || (freeNext[lease] != FREE_UNLINKED)) return;
+  byte next = INVALID_LEASE;
+  if (ordered)
+    for (next = freeHead[pool]; (next != INVALID_LEASE) && (next < lease); next = freeNext[next]) continue;
+  byte prev = (next != INVALID_LEASE) ? freePrev[next] : freeTail[pool];
+  freeNext[lease] = next;
+  freePrev[lease] = prev;
+  if (prev != INVALID_LEASE)
+    freeNext[prev] = lease;
+  else
+    freeHead[pool] = lease;
+  if (next != INVALID_LEASE)
+    freePrev[next] = lease;
+  else
+    freeTail[pool] = lease;
+}
+
+void DHCPServer::unlinkFree(byte lease) {
+  byte pool = leasePool[lease];
+  if ((pool >= DHCP_POOLS) || (freeNext[lease] == FREE_UNLINKED)) return;
+  if (freePrev[lease] != INVALID_LEASE)
+    freeNext[freePrev[lease]] = freeNext[lease];
+  else
+    freeHead[pool] = freeNext[lease];
+  if (freeNext[lease] != INVALID_LEASE)
+    freePrev[freeNext[lease]] = freePrev[lease];
+  else
+    freeTail[pool] = freePrev[lease];
+  freeNext[lease] = FREE_UNLINKED;
+  freePrev[lease] = FREE_UNLINKED;
+}
+
+void DHCPServer::updateFreeIndex(byte lease) {
+  if (!validLeaseNumber(lease)) return;
+  // in LRU mode a freed address queues behind every other free one; otherwise it takes its place by address
+  if (freeLease(lease, millis()))
+    linkFree(lease, memory.mem.allocMode != ALLOC_LRU);
+  else
+    unlinkFree(lease);
+}
+
+// Assigns every slot to its pool and rebuilds the free lists in ascending address order. Needed whenever
+// the subnet or range layout changes, or the lease table is reloaded.
+void DHCPServer::rebuildFreeIndex() {
+  long currTime = millis();
+  memset(freeHead, INVALID_LEASE, sizeof(freeHead));
+  memset(freeTail, INVALID_LEASE, sizeof(freeTail));
+  memset(freeNext, FREE_UNLINKED, sizeof(freeNext));
+  memset(freePrev, FREE_UNLINKED, sizeof(freePrev));
+  memset(leasePool, INVALID_POOL, sizeof(leasePool));
+
+  for (byte subnet = LOCAL_SUBNET; subnet <= RELAY_SUBNETS; subnet++) {
+    byte base;
+    byte count;
+    SubnetConfig config;
+    getSubnetRange(subnet, &base, &count);
+    getSubnetConfig(subnet, &config);
+    for (byte lease = base; lease < base + count; lease++) {
+      byte host = config.startAddress + (lease - base);
+      byte address[4];
+      // reserved addresses are handed out from the reservation table only
+      if (getLeaseIPAddress(lease, address) && reservedAddress(address)) continue;
+      leasePool[lease] = subnet;
+      for (byte i = 0; i < DHCP_RANGES; i++) {
+        RangeConfig* range = &memory.mem.ranges[i];
+        if ((range->leaseNum > 0) && (range->subnet == subnet) && (host >= range->startAddress) &&
+            (host < range->startAddress + range->leaseNum)) {
+          leasePool[lease] = RANGE_POOL(i);
+          break;
+        }
+      }
+    }
+  }
+
+  for (byte lease = 0; lease < leaseCount(); lease++)
+    if (freeLease(lease, currTime)) linkFree(lease, false);
+  rebuildClientIdIndex(); // the lease table may have been reloaded or resized
+  rebuildPortIndex();
+  rebuildClassTrie();
+  memset(sweepMissed, 0, sizeof(sweepMissed));
+}
+
+void DHCPServer::addressRange(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    AsciiTable table(terminal);
+    char index[4];
+    char range[16];
+    char match[20];
+    char lease[12];
+    table.addColumn(Normal, "Range", 7);
+    table.addColumn(Green, "Subnet/Start/Num", 18);
+    table.addColumn(Cyan, "Match", 20);
+    table.addColumn(Yellow, "Lease(s)", 12);
+    table.printHeader();
+    for (byte i = 0; i < DHCP_RANGES; i++) {
+      RangeConfig* config = &memory.mem.ranges[i];
+      snprintf(index, sizeof(index), "%d", i);
+      snprintf(range, sizeof(range), "%d/%d/%d", config->subnet, config->startAddress, config->leaseNum);
+      if (config->matchType == RANGE_MATCH_OUI)
+        snprintf(match, sizeof(match), "OUI %02X:%02X:%02X", config->oui[0], config->oui[1], config->oui[2]);
+      else if (config->matchType == RANGE_MATCH_VENDOR)
+        snprintf(match, sizeof(match), "%.*s", (int) sizeof(config->vendorClass), config->vendorClass);
+      else
+        snprintf(match, sizeof(match), "None");
+      snprintf(lease, sizeof(lease), "%lu", getPoolLeaseTime(RANGE_POOL(i)));
+      table.printData(index, range, match, lease);
+    }
+    table.printDone("Address Ranges");
+    terminal->prompt();
+    return;
+  }
+
+  bool success = false;
+  int index = atoi(value);
+  RangeConfig config;
+  memset(&config, 0, sizeof(config));
+  char* subnet = terminal->readParameter();
+  if ((subnet != NULL) && (strcmp(subnet, "off") == 0)) {
+    success = setRangeConfig(index, &config);
+  } else {
+    char* start = terminal->readParameter();
+    char* number = terminal->readParameter();
+    char* type = terminal->readParameter();
+    char* match = terminal->readParameter();
+    char* time = terminal->readParameter();
+    if ((subnet != NULL) && (start != NULL) && (number != NULL) && (type != NULL) && (match != NULL)) {
+      config.subnet = atoi(subnet);
+      config.startAddress = atoi(start);
+      config.leaseNum = atoi(number);
+      if (strcmp(type, "oui") == 0) {
+        byte mac[6] = {0, 0, 0, 0, 0, 0};
+        char oui[20];
+        snprintf(oui, sizeof(oui), "%s:00:00:00", match);
+        config.matchType = RANGE_MATCH_OUI;
+        if (parseMacString(oui, mac)) memcpy(config.oui, mac, sizeof(config.oui));
+      } else if (strcmp(type, "vendor") == 0) {
+        config.matchType = RANGE_MATCH_VENDOR;
+        strncpy(config.vendorClass, match, sizeof(config.vendorClass));
+      }
+      if (time != NULL) config.leaseTime = atol(time);
+      success = setRangeConfig(index, &config);
+      if (!success) terminal->println(ERROR, "Range index or subnet is invalid");
+    } else
+      terminal->println(ERROR, "Usage: range [n] [subnet] [start] [num] [oui|vendor] [match] [time] | range [n] off");
+  }
+  if (success) setInternal(true);
+  terminal->println((success) ? PASSED : FAILED, "Change Address Range Complete");
+  terminal->prompt();
+}
+
+void DHCPServer::allocationMode(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    terminal->print(INFO, "Allocation Mode: ");
+    terminal->println(INFO, (memory.mem.allocMode == ALLOC_LRU) ? "lru" : "lowest");
+  } else if ((strcmp(value, "lru") == 0) || (strcmp(value, "lowest") == 0)) {
+    memory.mem.allocMode = (strcmp(value, "lru") == 0) ? ALLOC_LRU : ALLOC_LOWEST;
+    rebuildFreeIndex();
+    setInternal(true);
+    terminal->println(PASSED, "Change Allocation Mode Complete");
+  } else
+    terminal->println(ERROR, "Parameter must be lru or lowest");
+  terminal->prompt();
+}
@@ -0,0 +1,169 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+static byte portBucket(const byte* circuitId, int length) {
+  uint32_t hash = fnv1a(circuitId, length);
+  return (hash ^ (hash >> 16)) & (PORT_BUCKETS - 1);
+}
+
+// Finds the port from the circuit id and remote id sub-options of option 82
+byte DHCPServer::getPortByAgentInfo(const byte* agentInfo, int length) {
+  const byte* circuitId = nullptr;
+  const byte* remoteId = nullptr;
+  int circuitLength = 0;
+  int remoteLength = 0;
+  for (int i = 0; i + 2 <= length; i += 2 + agentInfo[i + 1]) {
+    if (i + 2 + agentInfo[i + 1] > length) break;
+    if ((agentInfo[i] == DHCP_AGENT_CIRCUIT_ID) && !circuitId) {
+      circuitId = agentInfo + i + 2;
+      circuitLength = agentInfo[i + 1];
+    } else if ((agentInfo[i] == DHCP_AGENT_REMOTE_ID) && !remoteId) {
+      remoteId = agentInfo + i + 2;
+      remoteLength = agentInfo[i + 1];
+    }
+  }
+  if (!circuitId || (circuitLength == 0) || (circuitLength > RELAY_ID_SIZE)) return INVALID_PORT;
+
+  for (byte port = portHead[portBucket(circuitId, circuitLength)]; port != INVALID_PORT; port = portNext[port]) {
+    PortConfig* config = &memory.mem.ports[port];
+    if ((config->circuitLength != circuitLength) || (memcmp(config->circuitId, circuitId, circuitLength) != 0))
+      continue;
+    if ((config->remoteLength == 0) ||
+        ((config->remoteLength == remoteLength) && (memcmp(config->remoteId, remoteId, remoteLength) == 0)))
+      return port;
+  }
+  return INVALID_PORT;
+}
+
+// The port's range when it is enabled in the subnet the request came from, else the pool already chosen
+byte DHCPServer::getPortPool(byte port, byte subnet, byte pool) {
+  if (port >= DHCP_PORTS) return pool;
+  byte range = memory.mem.ports[port].range;
+  if ((range >= DHCP_RANGES) || (memory.mem.ranges[range].leaseNum == 0) || (memory.mem.ranges[range].subnet != subnet))
+    return pool;
+  return RANGE_POOL(range);
+}
+
+const byte* DHCPServer::getPortAddress(byte port) {
+  if ((port >= DHCP_PORTS) || zeroAddress(memory.mem.ports[port].ipAddress)) return nullptr;
+  return memory.mem.ports[port].ipAddress;
+}
+
+bool DHCPServer::setPortConfig(byte port, const PortConfig* config) {
+  if ((port >= DHCP_PORTS) || (config->circuitLength > RELAY_ID_SIZE) || (config->remoteLength > RELAY_ID_SIZE))
+    return false;
+  memcpy(&memory.mem.ports[port], config, sizeof(PortConfig));
+  if (!zeroAddress(config->ipAddress)) {
+    byte holder = getLeaseByIPAddress(config->ipAddress); // a dynamic client would share it with the port
+    if (validLease(holder)) deleteLease(holder);
+  }
+  rebuildFreeIndex(); // a port address leaves the dynamic pool
+  return true;
+}
+
+void DHCPServer::rebuildPortIndex() {
+  memset(portHead, INVALID_PORT, sizeof(portHead));
+  memset(portNext, INVALID_PORT, sizeof(portNext));
+  for (byte port = 0; port < DHCP_PORTS; port++) {
+    PortConfig* config = &memory.mem.ports[port];
+    if ((config->circuitLength == 0) || (config->circuitLength > RELAY_ID_SIZE)) continue;
+    byte bucket = portBucket(config->circuitId, config->circuitLength);
+    portNext[port] = portHead[bucket];
+    portHead[bucket] = port;
+  }
+}
+
+// Relay ids are opaque bytes: text as typed, or hex after 0x for the binary ids many switches send
+bool DHCPServer::parseRelayId(const char* text, byte* id, byte* length) {
+  if ((text[0] == '0') && ((text[1] == 'x') || (text[1] == 'X'))) {
+    text += 2;
+    int digits = strlen(text);
+    if ((digits == 0) || (digits % 2) || (digits / 2 > RELAY_ID_SIZE)) return false;
+    for (int i = 0; i < digits / 2; i++) {
+      char pair[3] = {text[i * 2], text[i * 2 + 1], 0};
+      if (!isxdigit(pair[0]) || !isxdigit(pair[1])) return false;
+      id[i] = strtoul(pair, NULL, 16);
+    }
+    *length = digits / 2;
+    return true;
+  }
+  int size = strlen(text);
+  if ((size == 0) || (size > RELAY_ID_SIZE)) return false;
+  memcpy(id, text, size);
+  *length = size;
+  return true;
+}
+
+char* DHCPServer::relayIdString(const byte* id, byte length, char* buffer, int size) {
+  bool printable = true;
+  for (byte i = 0; i < length; i++)
+    if (!isprint(id[i]) || (id[i] == ' ')) printable = false;
+  if (printable) {
+    snprintf(buffer, size, "%.*s", (int) length, (const char*) id);
+    return buffer;
+  }
+  int loc = snprintf(buffer, size, "0x");
+  for (byte i = 0; (i < length) && (loc + 2 < size); i++) loc += snprintf(buffer + loc, size - loc, "%02X", id[i]);
+  return buffer;
+}
+
+void DHCPServer::relayPort(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    AsciiTable table(terminal);
+    char index[4];
+    char circuit[RELAY_ID_SIZE * 2 + 3];
+    char remote[RELAY_ID_SIZE * 2 + 3];
+    char binding[20];
+    table.addColumn(Normal, "Port", 6);
+    table.addColumn(Green, "Circuit ID", RELAY_ID_SIZE * 2 + 5);
+    table.addColumn(Cyan, "Remote ID", RELAY_ID_SIZE * 2 + 5);
+    table.addColumn(Yellow, "Binding", 18);
+    table.printHeader();
+    for (byte i = 0; i < DHCP_PORTS; i++) {
+      PortConfig* config = &memory.mem.ports[i];
+      if (config->circuitLength == 0) continue;
+      snprintf(index, sizeof(index), "%d", i);
+      if (!zeroAddress(config->ipAddress))
+        getIPString(config->ipAddress, binding, sizeof(binding));
+      else if (config->range < DHCP_RANGES)
+        snprintf(binding, sizeof(binding), "Range %d", config->range);
+      else
+        snprintf(binding, sizeof(binding), "None");
+      table.printData(index, relayIdString(config->circuitId, config->circuitLength, circuit, sizeof(circuit)),
+                      (config->remoteLength) ? relayIdString(config->remoteId, config->remoteLength, remote,
+                                                             sizeof(remote))
+                                             : "Any",
+                      binding);
+    }
+    table.printDone("Relay Ports");
+    terminal->prompt();
+    return;
+  }
+
+  bool success = false;
+  int index = atoi(value);
+  PortConfig config;
+  memset(&config, 0, sizeof(config));
+  config.range = PORT_NO_RANGE;
+  char* circuit = terminal->readParameter();
+  char* kind = terminal->readParameter();
+  char* target = terminal->readParameter();
+  char* remote = terminal->readParameter();
+  if ((circuit != NULL) && (strcmp(circuit, "off") == 0)) {
+    success = setPortConfig(index, &config);
+  } else if ((circuit == NULL) || (kind == NULL) || (target == NULL) ||
+             !parseRelayId(circuit, config.circuitId, &config.circuitLength) ||
+             ((remote != NULL) && !parseRelayId(remote, config.remoteId, &config.remoteLength))) {
+    terminal->println(ERROR, "Usage: port [n] [circuit-id] [ip|range] [value] [remote-id] | port [n] off");
+  } else if ((strcmp(kind, "ip") == 0) && parseIPAddress(target, config.ipAddress)) {
+    success = setPortConfig(index, &config);
+  } else if ((strcmp(kind, "range") == 0) && (atoi(target) >= 0) && (atoi(target) < DHCP_RANGES)) {
+    config.range = atoi(target);
+    success = setPortConfig(index, &config);
+  } else
+    terminal->println(ERROR, "Binding must be ip [address] or range [n]");
+  if (success) setInternal(true);
+  terminal->println((success) ? PASSED : FAILED, "Change Relay Port Complete");
+  terminal->prompt();
+}
@@ -0,0 +1,154 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+// Only the attached network can be probed; ARP for a relayed address is answered by the gateway
+bool DHCPServer::probeWanted(byte subnet) {
+  return getConflictProbe() && (subnet == LOCAL_SUBNET);
+}
+
+bool DHCPServer::probingLease(byte lease) {
+  if (!validLeaseNumber(lease)) return false;
+  for (byte i = 0; i < DHCP_PROBES; i++)
+    if (probes[i].active && (probes[i].lease == lease)) return true;
+  return false;
+}
+
+bool DHCPServer::probesWaiting() {
+  for (byte i = 0; i < DHCP_PROBES; i++)
+    if (probes[i].active) return true;
+  return false;
+}
+
+void DHCPServer::holdForProbe(const PacketSlot* slot, byte lease, byte attempts) {
+  ProbeTransaction* probe = nullptr;
+  for (byte i = 0; (probe == nullptr) && (i < DHCP_PROBES); i++)
+    if (!probes[i].active) probe = &probes[i];
+  if ((probe == nullptr) || (attempts >= DHCP_PROBE_ATTEMPTS)) {
+    // the client sends the DISCOVER again in a few seconds; it must not find the address bound unprobed
+    if (probe == nullptr)
+      probeStats.busy++;
+    else
+      probeStats.abandoned++;
+    deleteLease(lease);
+    return;
+  }
+  probe->active = true;
+  probe->probing = false;
+  probe->lease = lease;
+  probe->attempts = attempts;
+  probe->heldAt = millis();
+  if (&probe->packet != slot) {
+    probe->packet.size = slot->size;
+    memcpy(probe->packet.buffer, slot->buffer, slot->size);
+  }
+}
+
+// The held DISCOVER goes through the engine again as if it had just arrived. After a silent probe the
+// address is already the client's binding and is offered; after a conflict it is quarantined, and the
+// next free address is held and probed in turn.
+void DHCPServer::finishProbe(ProbeTransaction* probe, bool conflict) {
+  if (conflict) {
+    probeStats.conflicts++;
+    declineLease(probe->lease, DHCP_CONFLICT_TIME); // a short decline time must not bring it straight back
+  }
+  probe->active = false;
+  DHCPReply reply;
+  if (engine.DHCPreply((RIP_MSG*) probe->packet.buffer, probe->packet.size, &reply) > 0) {
+    probeStats.offered++;
+    sendReply(&reply);
+  } else if (reply.probe)
+    holdForProbe(&probe->packet, reply.probeLease, probe->attempts + 1);
+}
+
+// One address is out on the probe socket at a time; the others wait in the order they were held. A lease
+// sweep probe in flight finishes first.
+void DHCPServer::runProbes() {
+  for (byte i = 0; i < DHCP_PROBES; i++) {
+    if (!probes[i].active || !probes[i].probing) continue;
+    byte result = arpProbe.poll();
+    if (result == ARP_PROBE_WAITING) return;
+    finishProbe(&probes[i], result == ARP_PROBE_ANSWERED);
+    break;
+  }
+
+  while (!arpProbe.busy()) {
+    ProbeTransaction* next = nullptr;
+    for (byte i = 0; i < DHCP_PROBES; i++) {
+      if (!probes[i].active || probes[i].probing) continue;
+      if ((next == nullptr) || ((long) (probes[i].heldAt - next->heldAt) < 0)) next = &probes[i];
+    }
+    if (next == nullptr) break;
+    byte address[4];
+    getLeaseIPAddress(next->lease, address);
+    if (arpProbe.start(address)) {
+      next->probing = true;
+      probeStats.probes++;
+      return;
+    }
+    finishProbe(next, false); // no socket to probe from; better a late offer than none
+  }
+  if (!getConflictProbe() && (getSweepMisses() == 0)) arpProbe.close();
+}
+
+// Bound, unexpired leases on the attached network; a marked lease is already expired
+bool DHCPServer::sweepCandidate(byte lease) {
+  return validLease(lease) && (leaseStatus[lease].status == DHCP_LEASE_ACK) && !getLeaseExpired(lease, millis()) &&
+         (getLeaseSubnet(lease) == LOCAL_SUBNET) && !probingLease(lease);
+}
+
+// A lease silent for too many sweeps in a row expires now instead of at the end of its lease time. It keeps
+// its client, so the client gets it back if it returns, but reclaimLease() may hand it out when the pool
+// runs dry.
+void DHCPServer::sweepResult(byte lease, bool answered) {
+  if (!sweepCandidate(lease)) return;
+  if (answered) {
+    sweepStats.answered++;
+    sweepMissed[lease] = 0;
+    return;
+  }
+  if ((getSweepMisses() == 0) || (++sweepMissed[lease] < getSweepMisses())) return;
+  sweepStats.marked++;
+  sweepMissed[lease] = SWEEP_MARKED;
+  leaseStatus[lease].expires = millis();
+}
+
+byte DHCPServer::sweepMarkedCount() {
+  byte count = 0;
+  for (byte lease = 0; lease < leaseCount(); lease++)
+    if ((sweepMissed[lease] == SWEEP_MARKED) && validLease(lease)) count++;
+  return count;
+}
+
+void DHCPServer::conflictProbe(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    terminal->print(INFO, "Conflict Probe: ");
+    terminal->println(INFO, (getConflictProbe()) ? "Enabled" : "Disabled");
+    AsciiTable table(terminal);
+    table.addColumn(Normal, "Outcome", 20);
+    table.addColumn(Yellow, "Count", 12);
+    table.printHeader();
+    char buffer[12];
+    byte waiting = 0;
+    for (byte i = 0; i < DHCP_PROBES; i++)
+      if (probes[i].active) waiting++;
+    auto row = [&](const char* outcome, unsigned long count) { table.printData(outcome, ultoa(count, buffer, 10)); };
+    row("Probes", probeStats.probes);
+    row("Conflicts", probeStats.conflicts);
+    row("Offered", probeStats.offered);
+    row("Busy", probeStats.busy);
+    row("Abandoned", probeStats.abandoned);
+    row("Waiting", waiting);
+    table.printDone("Conflict Probe");
+  } else if (strcmp(value, "on") == 0) {
+    setConflictProbe(true);
+    setInternal(true);
+    terminal->println(PASSED, "Conflict Probe Enabled");
+  } else if (strcmp(value, "off") == 0) {
+    setConflictProbe(false);
+    setInternal(true);
+    terminal->println(PASSED, "Conflict Probe Disabled");
+  } else
+    terminal->println(ERROR, "Parameter must be on or off");
+  terminal->prompt();
+}
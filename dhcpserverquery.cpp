@@ -0,0 +1,76 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+// RFC 4388 section 7: bindings are only disclosed to a requester on a network this server serves, and when
+// any requesters are configured, only to those
+bool DHCPServer::queryRequesterTrusted(const byte* giaddr) {
+  if (zeroAddress(giaddr)) return false;
+  bool served = false;
+  for (byte subnet = LOCAL_SUBNET; subnet <= RELAY_SUBNETS; subnet++)
+    if (addressInSubnet(subnet, giaddr)) served = true;
+  if (!served) return false;
+
+  bool listed = false;
+  for (byte i = 0; i < DHCP_QUERY_REQUESTERS; i++) {
+    if (zeroAddress(memory.mem.queryRequesters[i])) continue;
+    if (memcmp(memory.mem.queryRequesters[i], giaddr, 4) == 0) return true;
+    listed = true;
+  }
+  return !listed;
+}
+
+bool DHCPServer::addQueryRequester(const byte* address) {
+  byte* slot = nullptr;
+  for (byte i = 0; i < DHCP_QUERY_REQUESTERS; i++) {
+    if (memcmp(memory.mem.queryRequesters[i], address, 4) == 0) return true;
+    if (!slot && zeroAddress(memory.mem.queryRequesters[i])) slot = memory.mem.queryRequesters[i];
+  }
+  if (!slot || zeroAddress(address)) return false;
+  memcpy(slot, address, 4);
+  return true;
+}
+
+bool DHCPServer::removeQueryRequester(const byte* address) {
+  for (byte i = 0; i < DHCP_QUERY_REQUESTERS; i++) {
+    if (memcmp(memory.mem.queryRequesters[i], address, 4) != 0) continue;
+    memset(memory.mem.queryRequesters[i], 0, 4);
+    return true;
+  }
+  return false;
+}
+
+void DHCPServer::leaseQueryRequesters(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    AsciiTable table(terminal);
+    char address[20];
+    table.addColumn(Normal, "Requester", 19);
+    table.printHeader();
+    bool listed = false;
+    for (byte i = 0; i < DHCP_QUERY_REQUESTERS; i++) {
+      if (zeroAddress(memory.mem.queryRequesters[i])) continue;
+      table.printData(getIPString(memory.mem.queryRequesters[i], address, sizeof(address)));
+      listed = true;
+    }
+    if (!listed) table.printData("Any served subnet");
+    table.printDone("Leasequery Requesters");
+    terminal->prompt();
+    return;
+  }
+
+  bool success = false;
+  byte address[4];
+  char* ip = terminal->readParameter();
+  if ((ip == NULL) || !parseIPAddress(ip, address))
+    terminal->println(ERROR, "Usage: leasequery [add|remove] [ip]");
+  else if (strcmp(value, "add") == 0) {
+    success = addQueryRequester(address);
+    if (!success) terminal->println(ERROR, "Requester list is full");
+  } else if (strcmp(value, "remove") == 0)
+    success = removeQueryRequester(address);
+  else
+    terminal->println(ERROR, "Usage: leasequery [add|remove] [ip]");
+  if (success) setInternal(true);
+  terminal->println((success) ? PASSED : FAILED, "Change Leasequery Requesters Complete");
+  terminal->prompt();
+}
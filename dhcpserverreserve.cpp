@@ -0,0 +1,108 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+// Binary search of the reservation table; returns the index of the MAC address, or where it would be
+// inserted when it is not present
+int DHCPServer::findReservation(const byte* __macAddress, bool* found) {
+  int low = 0;
+  int high = memory.mem.reservationNum;
+  if (high > DHCP_RESERVATIONS) high = DHCP_RESERVATIONS;
+  *found = false;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    int compare = memcmp(memory.mem.reservations[middle].macAddress, __macAddress, 6);
+    if (compare == 0) {
+      *found = true;
+      return middle;
+    }
+    if (compare < 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+const byte* DHCPServer::getReservedAddress(const byte* __macAddress) {
+  bool found;
+  int index = findReservation(__macAddress, &found);
+  return (found) ? memory.mem.reservations[index].ipAddress : nullptr;
+}
+
+// Addresses fixed to a MAC address or to a relay port
+bool DHCPServer::reservedAddress(const byte* address) {
+  for (byte i = 0; (i < memory.mem.reservationNum) && (i < DHCP_RESERVATIONS); i++)
+    if (memcmp(memory.mem.reservations[i].ipAddress, address, 4) == 0) return true;
+  for (byte i = 0; i < DHCP_PORTS; i++)
+    if (memory.mem.ports[i].circuitLength && (memcmp(memory.mem.ports[i].ipAddress, address, 4) == 0)) return true;
+  return false;
+}
+
+bool DHCPServer::addReservation(const byte* __macAddress, const byte* address) {
+  bool found;
+  int index = findReservation(__macAddress, &found);
+  if (!found) {
+    if (memory.mem.reservationNum >= DHCP_RESERVATIONS) return false;
+    memmove(&memory.mem.reservations[index + 1], &memory.mem.reservations[index],
+            (memory.mem.reservationNum - index) * sizeof(Reservation));
+    memcpy(memory.mem.reservations[index].macAddress, __macAddress, 6);
+    memory.mem.reservationNum++;
+  }
+  memcpy(memory.mem.reservations[index].ipAddress, address, 4);
+
+  // a reserved host never holds a dynamic lease, and its address never goes to anyone else
+  byte lease = getLease((byte*) __macAddress);
+  if (validLeaseNumber(lease)) deleteLease(lease);
+  byte holder = getLeaseByIPAddress(address); // another client bound to the address would share it
+  if (validLease(holder)) deleteLease(holder);
+  rebuildFreeIndex();
+  return true;
+}
+
+bool DHCPServer::removeReservation(const byte* __macAddress) {
+  bool found;
+  int index = findReservation(__macAddress, &found);
+  if (!found) return false;
+  memory.mem.reservationNum--;
+  memmove(&memory.mem.reservations[index], &memory.mem.reservations[index + 1],
+          (memory.mem.reservationNum - index) * sizeof(Reservation));
+  memset(&memory.mem.reservations[memory.mem.reservationNum], 0, sizeof(Reservation));
+  rebuildFreeIndex();
+  return true;
+}
+
+void DHCPServer::reserveAddress(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    AsciiTable table(terminal);
+    char macBuffer[20];
+    char ipBuffer[20];
+    table.addColumn(Green, "MAC Address", 19);
+    table.addColumn(Normal, "IpAddress", 17);
+    table.printHeader();
+    for (byte i = 0; (i < memory.mem.reservationNum) && (i < DHCP_RESERVATIONS); i++)
+      table.printData(getMacString(memory.mem.reservations[i].macAddress, macBuffer, sizeof(macBuffer)),
+                      getIPString(memory.mem.reservations[i].ipAddress, ipBuffer, sizeof(ipBuffer)));
+    table.printDone("Reservations");
+    terminal->prompt();
+    return;
+  }
+
+  bool success = false;
+  byte mac[6];
+  byte address[4];
+  char* parameter = terminal->readParameter();
+  if (!parseMacString(value, mac) || (parameter == NULL)) {
+    terminal->println(ERROR, "Usage: reserve [mac] [ip] | reserve [mac] off");
+  } else if (strcmp(parameter, "off") == 0) {
+    success = removeReservation(mac);
+    if (!success) terminal->println(ERROR, "No reservation for that MAC address");
+  } else if (parseIPAddress(parameter, address)) {
+    success = addReservation(mac, address);
+    if (!success) terminal->println(ERROR, "Reservation table is full");
+  } else
+    terminal->println(ERROR, "IP Address is invalid");
+  if (success) setInternal(true);
+  terminal->println((success) ? PASSED : FAILED, "Change Reservation Complete");
+  terminal->prompt();
+}
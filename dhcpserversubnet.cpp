@@ -0,0 +1,171 @@
+#include "asciitable/asciitable.h"
+#include "dhcpserver.h"
+
+static bool sameNetwork(const byte* address, const byte* network, const byte* mask) {
+  for (int i = 0; i < 4; i++)
+    if ((address[i] & mask[i]) != (network[i] & mask[i])) return false;
+  return true;
+}
+
+byte DHCPServer::leaseCount() {
+  unsigned int count = memory.mem.leaseNum;
+  for (byte i = 0; i < RELAY_SUBNETS; i++) count += memory.mem.subnets[i].leaseNum;
+  return (count > LEASESNUM) ? LEASESNUM : count;
+}
+
+// The local range always starts the table; relay subnets follow it in order. A range that would run past
+// the end of the table is clipped.
+bool DHCPServer::getSubnetRange(byte subnet, byte* base, byte* count) {
+  if (subnet > RELAY_SUBNETS) return false;
+  unsigned int first = 0;
+  unsigned int size = memory.mem.leaseNum;
+  for (byte i = 1; i <= subnet; i++) {
+    first += size;
+    size = memory.mem.subnets[i - 1].leaseNum;
+  }
+  if (first > LEASESNUM) first = LEASESNUM;
+  if (first + size > LEASESNUM) size = LEASESNUM - first;
+  *base = first;
+  *count = size;
+  return true;
+}
+
+byte DHCPServer::getLeaseSubnet(byte lease) {
+  for (byte subnet = LOCAL_SUBNET; subnet <= RELAY_SUBNETS; subnet++) {
+    byte base;
+    byte count;
+    getSubnetRange(subnet, &base, &count);
+    if ((lease >= base) && (lease < base + count)) return subnet;
+  }
+  return INVALID_SUBNET;
+}
+
+byte DHCPServer::getSubnetForRelay(const byte* giaddr) {
+  if (zeroAddress(giaddr)) return LOCAL_SUBNET;
+  for (byte i = 0; i < RELAY_SUBNETS; i++) {
+    SubnetConfig* subnet = &memory.mem.subnets[i];
+    if ((subnet->leaseNum > 0) && sameNetwork(giaddr, subnet->network, subnet->subnetMask)) return i + 1;
+  }
+  return INVALID_SUBNET;
+}
+
+void DHCPServer::getSubnetConfig(byte subnet, SubnetConfig* config) {
+  memset(config, 0, sizeof(SubnetConfig));
+  if (subnet == LOCAL_SUBNET) {
+    if (ipAddress && subnetMask) {
+      for (int i = 0; i < 4; i++) config->network[i] = ipAddress[i] & subnetMask[i];
+      memcpy(config->subnetMask, subnetMask, 4);
+      memcpy(config->router, ipAddress, 4);
+      memcpy(config->dns, ipAddress, 4);
+    }
+    config->startAddress = memory.mem.startAddressNumber;
+    config->leaseNum = memory.mem.leaseNum;
+  } else if (subnet <= RELAY_SUBNETS) {
+    memcpy(config, &memory.mem.subnets[subnet - 1], sizeof(SubnetConfig));
+    for (int i = 0; i < 4; i++) config->network[i] &= config->subnetMask[i];
+    if (zeroAddress(config->dns) && ipAddress) memcpy(config->dns, ipAddress, 4);
+  }
+}
+
+// A subnet that is not set up serves nothing; its 0.0.0.0 mask would otherwise match every address
+bool DHCPServer::addressInSubnet(byte subnet, const byte* address) {
+  SubnetConfig config;
+  getSubnetConfig(subnet, &config);
+  if (zeroAddress(config.subnetMask) || ((subnet != LOCAL_SUBNET) && (config.leaseNum == 0))) return false;
+  return sameNetwork(address, config.network, config.subnetMask);
+}
+
+bool DHCPServer::setSubnetConfig(byte subnet, const SubnetConfig* config) {
+  if ((subnet == LOCAL_SUBNET) || (subnet > RELAY_SUBNETS)) return false;
+  unsigned int total = memory.mem.leaseNum + config->leaseNum;
+  for (byte i = 0; i < RELAY_SUBNETS; i++)
+    if (i != subnet - 1) total += memory.mem.subnets[i].leaseNum;
+  if (total > LEASESNUM) return false;
+
+  // Relay ranges are packed behind each other, so resizing one moves its slots and those of the ones after
+  // it. Readdressing one moves only its own; a new router or DNS server keeps every binding.
+  SubnetConfig* current = &memory.mem.subnets[subnet - 1];
+  byte base;
+  byte count;
+  getSubnetRange(subnet, &base, &count);
+  if (config->leaseNum != current->leaseNum)
+    count = LEASESNUM - base;
+  else if ((memcmp(config->network, current->network, 4) == 0) &&
+           (memcmp(config->subnetMask, current->subnetMask, 4) == 0) &&
+           (config->startAddress == current->startAddress))
+    count = 0;
+  for (byte lease = base; lease < base + count; lease++) deleteLease(lease);
+  memcpy(current, config, sizeof(SubnetConfig));
+  rebuildFreeIndex();
+  return true;
+}
+
+// The relay subnets are packed behind the local range, so resizing it moves every relay slot; their bindings
+// would land on other addresses, and are dropped like setSubnetConfig() drops them
+bool DHCPServer::setLocalRange(byte start, byte num) {
+  if ((start < 1) || (start + num > 255) || (num + leaseCount() - memory.mem.leaseNum > LEASESNUM)) return false;
+  if (num != memory.mem.leaseNum) {
+    byte first = (num < memory.mem.leaseNum) ? num : memory.mem.leaseNum;
+    for (byte lease = first; lease < LEASESNUM; lease++) deleteLease(lease);
+  }
+  memory.mem.startAddressNumber = start;
+  memory.mem.leaseNum = num;
+  rebuildFreeIndex();
+  return true;
+}
+
+void DHCPServer::relaySubnet(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    AsciiTable table(terminal);
+    char index[4];
+    char network[20];
+    char mask[20];
+    char router[20];
+    char range[12];
+    table.addColumn(Normal, "Subnet", 8);
+    table.addColumn(Green, "Network", 17);
+    table.addColumn(Green, "Mask", 17);
+    table.addColumn(Cyan, "Router", 17);
+    table.addColumn(Yellow, "Start/Num", 12);
+    table.printHeader();
+    for (byte i = 0; i < RELAY_SUBNETS; i++) {
+      SubnetConfig* subnet = &memory.mem.subnets[i];
+      snprintf(index, sizeof(index), "%d", i + 1);
+      snprintf(range, sizeof(range), "%d/%d", subnet->startAddress, subnet->leaseNum);
+      table.printData(index, getIPString(subnet->network, network, sizeof(network)),
+                      getIPString(subnet->subnetMask, mask, sizeof(mask)),
+                      (zeroAddress(subnet->router)) ? "Relay" : getIPString(subnet->router, router, sizeof(router)),
+                      range);
+    }
+    table.printDone("Relay Subnets");
+    terminal->prompt();
+    return;
+  }
+
+  bool success = false;
+  int index = atoi(value);
+  SubnetConfig config;
+  memset(&config, 0, sizeof(config));
+  char* network = terminal->readParameter();
+  if ((network != NULL) && (strcmp(network, "off") == 0)) {
+    success = setSubnetConfig(index, &config);
+  } else {
+    char* mask = terminal->readParameter();
+    char* start = terminal->readParameter();
+    char* number = terminal->readParameter();
+    char* router = terminal->readParameter();
+    if ((network != NULL) && (mask != NULL) && (start != NULL) && (number != NULL) &&
+        parseIPAddress(network, config.network) && parseIPAddress(mask, config.subnetMask)) {
+      if (router != NULL) parseIPAddress(router, config.router);
+      config.startAddress = atoi(start);
+      config.leaseNum = atoi(number);
+      success = setSubnetConfig(index, &config);
+      if (!success) terminal->println(ERROR, "Subnet index is invalid or the lease table is full");
+    } else
+      terminal->println(ERROR, "Usage: subnet [n] [network] [mask] [start] [num] [router] | subnet [n] off");
+  }
+  if (success) setInternal(true);
+  terminal->println((success) ? PASSED : FAILED, "Change Relay Subnet Complete");
+  terminal->prompt();
+}
@@ -1,5 +1,6 @@
 #include "DHCPLite.h"
 #include "asciitable/asciitable.h"
+#include "dhcpalloc.h"
 #include "dhcpserver.h"
 
 void DHCPServer::addCmd(TerminalCommand* __termCmd) {
@@ -15,6 +16,39 @@ void DHCPServer::addCmd(TerminalCommand* __termCmd) {
                     [this](TerminalLibrary::OutputInterface* terminal) { startAddress(terminal); });
   __termCmd->addCmd("num", "[n]", "Restricts the number of leases available.",
                     [this](TerminalLibrary::OutputInterface* terminal) { leaseNum(terminal); });
+  __termCmd->addCmd("rapid", "[on|off]", "Enables DHCP Rapid Commit (option 80).",
+                    [this](TerminalLibrary::OutputInterface* terminal) { rapidCommit(terminal); });
+  __termCmd->addCmd("decline", "[n]", "Configures how long a declined address is quarantined (0 restores the default).",
+                    [this](TerminalLibrary::OutputInterface* terminal) { declineTime(terminal); });
+  __termCmd->addCmd("subnet", "[n] [network] [mask] [start] [num] [router]",
+                    "Configures a subnet served through a relay agent.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { relaySubnet(terminal); });
+  __termCmd->addCmd("range", "[n] [subnet] [start] [num] [oui|vendor] [match] [time]",
+                    "Configures an address range with its own lease time.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { addressRange(terminal); });
+  __termCmd->addCmd("reserve", "[mac] [ip]", "Reserves an IP address for a MAC address.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { reserveAddress(terminal); });
+  __termCmd->addCmd("history", "[on|off|clear]", "Displays the last address of departed clients.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { addressHistory(terminal); });
+  __termCmd->addCmd("alloc-mode", "[lru|lowest]", "Selects how free addresses are handed out.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { allocationMode(terminal); });
+  __termCmd->addCmd("boot", "[n] [next-server] [file]", "Configures network boot for an address range.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { bootOptions(terminal); });
+  __termCmd->addCmd("port", "[n] [circuit-id] [ip|range] [value] [remote-id]",
+                    "Binds a relay port (option 82) to an address or range.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { relayPort(terminal); });
+  __termCmd->addCmd("profile", "[n] [omit|send] [codes]", "Sets the options an address range's clients get.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { classProfile(terminal); });
+  __termCmd->addCmd("leasequery", "[add|remove] [ip]", "Restricts who may query lease bindings (RFC 4388).",
+                    [this](TerminalLibrary::OutputInterface* terminal) { leaseQueryRequesters(terminal); });
+  __termCmd->addCmd("probe", "[on|off]", "Probes new addresses with ARP before offering them.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { conflictProbe(terminal); });
+  __termCmd->addCmd("drops", "", "Displays the packets dropped by the receive filter and the reply send times.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { showDrops(terminal); });
+#ifdef DHCP_ALLOC_TRACE
+  __termCmd->addCmd("alloc", "", "Displays heap allocations seen on the packet path.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { allocReport(terminal); });
+#endif
 }
 
 void DHCPServer::reservePins(BackendPinSetup* pinsetup) {
@@ -22,29 +56,52 @@ void DHCPServer::reservePins(BackendPinSetup* pinsetup) {
 }
 
 bool DHCPServer::setupTask(OutputInterface* __terminal) {
-  broadcast = new IPAddress(broadcastAddress[0], broadcastAddress[1], broadcastAddress[2], broadcastAddress[3]);
+  rebuildFreeIndex();
   Udp.begin(DHCP_SERVER_PORT);
   setRefreshMilli(10);
   return true;
 }
 
 bool DHCPServer::executeTask() {
-  int packetSize = 0;
-  unsigned char packetBuffer[DHCP_MESSAGE_SIZE];
-  packetSize = Udp.parsePacket();
-  if (packetSize > 0) {
-    // read the packet into packetBuffer
-    Udp.read(packetBuffer, DHCP_MESSAGE_SIZE);
-    packetSize = DHCPreply((RIP_MSG*) packetBuffer, packetSize, ipAddress, domainName);
-    Udp.beginPacket(*broadcast, Udp.remotePort());
-
-    Udp.write(packetBuffer, packetSize);
-
-    Udp.endPacket();
+  DHCP_NO_ALLOC_SCOPE("executeTask");
+  PacketSlot* slot;
+
+  // drain everything the W5500 is holding before transmitting, so new datagrams can land while we reply
+  while ((slot = packetRing.reserve()) != nullptr) {
+    int packetSize = Udp.parsePacket();
+    if (packetSize <= 0) break;
+    slot->size = receivePacket(slot, packetSize);
+    if (slot->size <= 0) continue; // rejected by the filter; the slot is reused for the next datagram
+    packetRing.commit();
+  }
+
+  while ((slot = packetRing.front()) != nullptr) {
+    DHCPReply reply;
+    if (engine.DHCPreply((RIP_MSG*) slot->buffer, slot->size, &reply) > 0)
+      sendReply(&reply);
+    else if (reply.probe)
+      holdForProbe(slot, reply.probeLease, 0);
+    packetRing.pop();
   }
+  runProbes();
   return true;
 }
 
+void DHCPServer::sendReply(DHCPReply* reply) {
+  unsigned long start = micros();
+  Udp.beginPacket(IPAddress((reply->broadcast) ? broadcastAddress : reply->destination), reply->port);
+
+  // each segment streams straight into the W5500 transmit buffer
+  for (byte i = 0; i < reply->segments; i++) Udp.write(reply->segment[i].data, reply->segment[i].length);
+
+  Udp.endPacket();
+  unsigned long elapsed = micros() - start;
+  replyStats.replies++;
+  replyStats.bytes += reply->length;
+  replyStats.micros += elapsed;
+  if (elapsed > replyStats.worstMicros) replyStats.worstMicros = elapsed;
+}
+
 void DHCPServer::leaseTime(OutputInterface* terminal) {
   char* value;
   value = terminal->readParameter();
@@ -60,9 +117,40 @@ void DHCPServer::leaseTime(OutputInterface* terminal) {
   terminal->prompt();
 }
 
+void DHCPServer::declineTime(OutputInterface* terminal) {
+  char* value;
+  value = terminal->readParameter();
+  if (value == NULL) {
+    terminal->print(INFO, "Decline Time: ");
+    terminal->println(INFO, String(getDeclineTime()));
+  } else {
+    setDeclineTime(atoi(value));
+    setInternal(true);
+  }
+  terminal->prompt();
+}
+
+void DHCPServer::rapidCommit(OutputInterface* terminal) {
+  char* value;
+  value = terminal->readParameter();
+  if (value == NULL) {
+    terminal->print(INFO, "Rapid Commit: ");
+    terminal->println(INFO, (getRapidCommit()) ? "Enabled" : "Disabled");
+  } else if (strcmp(value, "on") == 0) {
+    setRapidCommit(true);
+    setInternal(true);
+    terminal->println(PASSED, "Rapid Commit Enabled");
+  } else if (strcmp(value, "off") == 0) {
+    setRapidCommit(false);
+    setInternal(true);
+    terminal->println(PASSED, "Rapid Commit Disabled");
+  } else
+    terminal->println(ERROR, "Parameter must be on or off");
+  terminal->prompt();
+}
+
 void DHCPServer::showLeases(OutputInterface* terminal) {
   AsciiTable table(terminal);
-  char buffer[20];
   byte ipAddress[4] = {0, 0, 0, 0};
   long current = millis();
   terminal->print(INFO, "Lease Time: ");
@@ -74,25 +162,22 @@ void DHCPServer::showLeases(OutputInterface* terminal) {
   table.addColumn(Green, "MAC Address", 19);
   table.addColumn(Cyan, "Expires(s)", 12);
   table.addColumn(Yellow, "Status", 19);
+  table.addColumn(Normal, "Host Name", HOSTNAME_SIZE + 2);
 
   table.printHeader();
 
-  String ipaddress = getIPString(ipAddress, buffer, sizeof(buffer));
-  String mac = "N/A";
-  String expires = "N/A";
-  String status = "DHCP Server";
-  table.printData(ipaddress, mac, expires, status);
+  char ipBuffer[20];
+  char macBuffer[20];
+  char expiresBuffer[24];
+  table.printData(getIPString(ipAddress, ipBuffer, sizeof(ipBuffer)), "N/A", "N/A", "DHCP Server", "");
 
-  for (int i = 0; i < memory.mem.leaseNum; i++) {
-    if (validLease(i)) {
+  for (int i = 0; i < leaseCount(); i++) {
+    if (validLease(i) || quarantinedLease(i, current)) {
       getLeaseIPAddress(i, ipAddress);
-      ipaddress = getIPString(ipAddress, buffer, sizeof(buffer));
-      mac = getMacString(getLeaseMACAddress(i), buffer, sizeof(buffer));
-      expires = "";
-      if (getLeaseExpired(i, current)) expires += "- ";
-      expires += timeString(getLeaseExpiresSec(i, current), buffer, sizeof(buffer));
-      status = leaseStatusString(leaseStatus[i].status);
-      table.printData(ipaddress, mac, expires, status);
+      table.printData(getIPString(ipAddress, ipBuffer, sizeof(ipBuffer)),
+                      getMacString(getLeaseMACAddress(i), macBuffer, sizeof(macBuffer)),
+                      leaseExpiresString(i, current, expiresBuffer, sizeof(expiresBuffer)),
+                      leaseStatusString(leaseStatus[i].status), getHostName(i));
     }
   }
   table.printDone("Lease Table");
@@ -142,8 +227,7 @@ void DHCPServer::startAddress(OutputInterface* terminal) {
   bool success = false;
   int address = atoi(terminal->readParameter());
   if ((address > 1) && (address < 255)) {
-    if ((memory.mem.leaseNum + address) < 255) {
-      memory.mem.startAddressNumber = address;
+    if (((memory.mem.leaseNum + address) < 255) && setLocalRange(address, memory.mem.leaseNum)) {
       success = true;
       setInternal(true);
     }
@@ -157,9 +241,8 @@ void DHCPServer::startAddress(OutputInterface* terminal) {
 void DHCPServer::leaseNum(OutputInterface* terminal) {
   bool success = false;
   int number = atoi(terminal->readParameter());
-  if ((number >= 0) && (number < LEASESNUM)) {
-    if ((number + memory.mem.startAddressNumber) < 255) {
-      memory.mem.leaseNum = number;
+  if ((number >= 0) && (number + leaseCount() - memory.mem.leaseNum <= LEASESNUM)) {
+    if (((number + memory.mem.startAddressNumber) < 255) && setLocalRange(memory.mem.startAddressNumber, number)) {
       success = true;
       setInternal(true);
     }
@@ -168,4 +251,27 @@ void DHCPServer::leaseNum(OutputInterface* terminal) {
   terminal->println(ERROR, "Address space and leases are restricted in the fourth octet to 1 - 254");
   terminal->println((success) ? PASSED : FAILED, "Change Number of Leases Available Complete");
   terminal->prompt();
-}
\ No newline at end of file
+}
+#ifdef DHCP_ALLOC_TRACE
+void DHCPServer::allocReport(OutputInterface* terminal) {
+  StringBuilder sb;
+  sb = "Allocations: ";
+  sb + allocStats.allocations;
+  terminal->println(INFO, sb.c_str());
+  sb = "Releases: ";
+  sb + allocStats.releases;
+  terminal->println(INFO, sb.c_str());
+  sb = "Packet Scopes: ";
+  sb + allocStats.scopes;
+  terminal->println(INFO, sb.c_str());
+  sb = "Violations: ";
+  sb + allocStats.violations;
+  terminal->println((allocStats.violations == 0) ? PASSED : FAILED, sb.c_str());
+  if (allocStats.lastViolation) {
+    sb = "Last Violation: ";
+    sb + allocStats.lastViolation;
+    terminal->println(ERROR, sb.c_str());
+  }
+  terminal->prompt();
+}
+#endif
@@ -0,0 +1,23 @@
+#ifndef __DHCP_UTIL_H
+#define __DHCP_UTIL_H
+
+#include <Arduino.h>
+
+#define FNV_OFFSET_BASIS 2166136261UL
+#define FNV_PRIME 16777619UL
+
+inline bool zeroAddress(const byte* address) {
+  return (address[0] | address[1] | address[2] | address[3]) == 0;
+}
+
+// FNV-1a, the hash behind every chained index; pass a previous result as seed to hash several fields
+inline uint32_t fnv1a(const byte* data, int length, uint32_t seed = FNV_OFFSET_BASIS) {
+  uint32_t hash = seed;
+  for (int i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+#endif // __DHCP_UTIL_H
@@ -0,0 +1,280 @@
+#include "dnsserver.h"
+
+static unsigned long readLong(const byte* message, int offset) {
+  return ((unsigned long) dnsGetWord(message, offset) << 16) | dnsGetWord(message, offset + 2);
+}
+
+static unsigned long cacheHash(const char* name, uint16_t type, uint16_t dnsClass) {
+  uint32_t hash = fnv1a((const byte*) name, strlen(name));
+  hash ^= ((uint32_t) type << 16) | dnsClass;
+  hash *= FNV_PRIME;
+  return (hash == 0) ? 1 : hash;
+}
+
+// Offset just past a possibly compressed name, or -1
+static int skipName(const byte* message, int size, int offset) {
+  while (offset < size) {
+    byte label = message[offset];
+    if ((label & 0xC0) == 0xC0) return (offset + 2 <= size) ? offset + 2 : -1;
+    offset += label + 1;
+    if (label == 0) return offset;
+  }
+  return -1;
+}
+
+// Offset of the first resource record after the question section, or -1
+static int firstRecord(const byte* message, int size) {
+  int offset = DNS_HEADER_SIZE;
+  for (uint16_t question = dnsGetWord(message, 4); question > 0; question--) {
+    offset = skipName(message, size, offset);
+    if ((offset < 0) || (offset + 4 > size)) return -1;
+    offset += 4;
+  }
+  return offset;
+}
+
+// How long a response may be cached, in seconds: the lowest answer TTL, or for NXDOMAIN/NODATA the
+// SOA minimum (RFC 2308). 0 means the response is not cached.
+static unsigned long cacheTtl(const byte* message, int size) {
+  int offset = firstRecord(message, size);
+  if (offset < 0) return 0;
+  uint16_t answers = dnsGetWord(message, 6);
+  uint16_t records = answers + dnsGetWord(message, 8);
+  bool negative = ((dnsGetWord(message, 2) & 0x0F) == DNS_RCODE_NXDOMAIN) || (answers == 0);
+  unsigned long ttl = (negative) ? DNS_NEGATIVE_TTL : DNS_CACHE_MAX_TTL;
+  for (uint16_t i = 0; i < records; i++) {
+    offset = skipName(message, size, offset);
+    if ((offset < 0) || (offset + 10 > size)) return 0;
+    uint16_t type = dnsGetWord(message, offset);
+    unsigned long recordTtl = readLong(message, offset + 4);
+    uint16_t rdLength = dnsGetWord(message, offset + 8);
+    offset += 10 + rdLength;
+    if (offset > size) return 0;
+    if (!negative && (i < answers) && (recordTtl < ttl)) ttl = recordTtl;
+    if (negative && (i >= answers) && (type == DNS_TYPE_SOA) && (rdLength >= 20)) {
+      unsigned long minimum = readLong(message, offset - 4);
+      ttl = (recordTtl < minimum) ? recordTtl : minimum;
+      if (ttl > DNS_CACHE_MAX_TTL) ttl = DNS_CACHE_MAX_TTL;
+    }
+  }
+  return ttl;
+}
+
+// Counts the time a response spent in the cache off every TTL in it
+static void ageRecords(byte* message, int size, unsigned long elapsed) {
+  int offset = firstRecord(message, size);
+  if (offset < 0) return;
+  uint16_t records = dnsGetWord(message, 6) + dnsGetWord(message, 8) + dnsGetWord(message, 10);
+  for (uint16_t i = 0; i < records; i++) {
+    offset = skipName(message, size, offset);
+    if ((offset < 0) || (offset + 10 > size)) return;
+    if (dnsGetWord(message, offset) != DNS_TYPE_OPT) {
+      unsigned long ttl = readLong(message, offset + 4);
+      ttl = (ttl > elapsed) ? ttl - elapsed : 0;
+      dnsPutWord(message, offset + 4, ttl >> 16);
+      dnsPutWord(message, offset + 6, ttl & 0xFFFF);
+    }
+    offset += 10 + dnsGetWord(message, offset + 8);
+  }
+}
+
+bool DNSServer::forwarding() {
+  return !zeroAddress(leases->getDNSUpstream());
+}
+
+void DNSServer::clearCache() {
+  for (byte i = 0; i < DNS_CACHE_SIZE; i++) cache[i].hash = 0;
+}
+
+DNSCacheEntry* DNSServer::findCache(unsigned long hash, const char* name, uint16_t type, uint16_t dnsClass) {
+  unsigned long currTime = millis();
+  for (byte i = 0; i < DNS_CACHE_SIZE; i++) {
+    DNSCacheEntry* entry = &cache[i];
+    if ((entry->hash != hash) || (entry->type != type) || (entry->dnsClass != dnsClass) ||
+        (strcmp(entry->name, name) != 0))
+      continue;
+    if ((long) (currTime - entry->expires) >= 0) {
+      entry->hash = 0; // stale; fetch it again
+      return nullptr;
+    }
+    return entry;
+  }
+  return nullptr;
+}
+
+// Replaces an unused entry, or else the least recently used one
+void DNSServer::storeCache(const DNSPending* query, const byte* message, int size) {
+  byte rcode = dnsGetWord(message, 2) & 0x0F;
+  if ((size > DNS_CACHE_RESPONSE) || (strlen(query->name) >= DNS_CACHE_NAME)) return;
+  if ((dnsGetWord(message, 2) & DNS_FLAG_TC) || ((rcode != DNS_RCODE_NOERROR) && (rcode != DNS_RCODE_NXDOMAIN))) return;
+  unsigned long ttl = cacheTtl(message, size);
+  if (ttl == 0) return;
+
+  unsigned long hash = cacheHash(query->name, query->type, query->dnsClass);
+  DNSCacheEntry* entry = findCache(hash, query->name, query->type, query->dnsClass);
+  for (byte i = 0; (entry == nullptr) && (i < DNS_CACHE_SIZE); i++)
+    if (cache[i].hash == 0) entry = &cache[i];
+  if (entry == nullptr) {
+    entry = &cache[0];
+    for (byte i = 1; i < DNS_CACHE_SIZE; i++)
+      if (cache[i].lastUsed < entry->lastUsed) entry = &cache[i];
+  }
+
+  entry->hash = hash;
+  entry->type = query->type;
+  entry->dnsClass = query->dnsClass;
+  entry->stored = millis();
+  entry->expires = entry->stored + (ttl * 1000);
+  entry->lastUsed = ++cacheClock;
+  entry->length = size;
+  strcpy(entry->name, query->name);
+  memcpy(entry->response, message, size);
+}
+
+// Answers from the cache, or sends the question upstream and answers when the response comes back.
+// size is the end of the question; anything the client sent after it is not forwarded.
+int DNSServer::forwardQuery(byte* message, int size, const char* name, uint16_t type, uint16_t dnsClass) {
+  uint16_t flags = dnsGetWord(message, 2);
+  if (!forwarding() || !(flags & DNS_FLAG_RD)) {
+    stats.refused++;
+    return finish(message, size, flags, DNS_RCODE_REFUSED, false, 0);
+  }
+
+  DNSCacheEntry* entry = findCache(cacheHash(name, type, dnsClass), name, type, dnsClass);
+  if (entry) {
+    stats.cacheHits++;
+    uint16_t id = dnsGetWord(message, 0);
+    memcpy(message, entry->response, entry->length);
+    dnsPutWord(message, 0, id);
+    ageRecords(message, entry->length, (millis() - entry->stored) / 1000);
+    entry->lastUsed = ++cacheClock;
+    return entry->length;
+  }
+  stats.cacheMisses++;
+
+  DNSPending* query = nullptr;
+  for (byte i = 0; (query == nullptr) && (i < DNS_PENDING); i++)
+    if (!pending[i].active) query = &pending[i];
+  if (query == nullptr) {
+    stats.servFail++;
+    return finish(message, size, flags, DNS_RCODE_SERVFAIL, false, 0);
+  }
+  // between bursts, the next query leaves from a fresh port; answers to the old one are dropped with it
+  bool idle = true;
+  for (byte i = 0; i < DNS_PENDING; i++)
+    if (pending[i].active) idle = false;
+  if (idle) rotateUpstreamPort();
+  query->active = true;
+  query->id = newQueryId();
+  query->clientId = dnsGetWord(message, 0);
+  query->client = Udp.remoteIP();
+  query->port = Udp.remotePort();
+  query->sent = millis();
+  query->type = type;
+  query->dnsClass = dnsClass;
+  strcpy(query->name, name);
+
+  dnsPutWord(message, 0, query->id);
+  dnsPutWord(message, 6, 0);
+  dnsPutWord(message, 8, 0);
+  dnsPutWord(message, 10, 0);
+  upstreamUdp.beginPacket(IPAddress(leases->getDNSUpstream()), DNS_PORT);
+  upstreamUdp.write(message, size);
+  upstreamUdp.endPacket();
+  return 0;
+}
+
+// A random id from the hardware generator, unique among the queries still waiting
+uint16_t DNSServer::newQueryId() {
+  uint16_t id;
+  bool taken;
+  do {
+    id = rp2040.hwrand32();
+    taken = false;
+    for (byte i = 0; i < DNS_PENDING; i++)
+      if (pending[i].active && (pending[i].id == id)) taken = true;
+  } while (taken);
+  return id;
+}
+
+// The upstream socket is opened by the first forwarded query, so it only takes one of the W5500's
+// sockets while forwarding is on
+void DNSServer::rotateUpstreamPort() {
+  if (upstreamPort != 0) upstreamUdp.stop();
+  upstreamPort = DNS_UPSTREAM_PORT + (rp2040.hwrand32() % DNS_UPSTREAM_PORTS);
+  upstreamUdp.begin(upstreamPort);
+}
+
+// Gives the socket back once forwarding is turned off; queries still waiting are dropped with it
+void DNSServer::closeUpstream() {
+  if (upstreamPort == 0) return;
+  upstreamUdp.stop();
+  upstreamPort = 0;
+  for (byte i = 0; i < DNS_PENDING; i++) pending[i].active = false;
+}
+
+void DNSServer::receiveUpstream() {
+  for (byte i = 0; i < DNS_QUERIES_PER_TICK; i++) {
+    int packetSize = upstreamUdp.parsePacket();
+    if (packetSize <= 0) break;
+    if (packetSize > DNS_MESSAGE_SIZE) packetSize = DNS_MESSAGE_SIZE;
+    int size = upstreamUdp.read(buffer, packetSize);
+    if ((size < DNS_HEADER_SIZE) || !(dnsGetWord(buffer, 2) & DNS_FLAG_QR)) continue;
+    if (!(upstreamUdp.remoteIP() == IPAddress(leases->getDNSUpstream())) || (upstreamUdp.remotePort() != DNS_PORT))
+      continue;
+
+    DNSPending* query = nullptr;
+    for (byte j = 0; (query == nullptr) && (j < DNS_PENDING); j++)
+      if (pending[j].active && (pending[j].id == dnsGetWord(buffer, 0))) query = &pending[j];
+    if (query == nullptr) continue;
+
+    // the response must be for the question that was asked
+    char name[DNS_NAME_SIZE];
+    int loc = (dnsGetWord(buffer, 4) == 1) ? readName(buffer, size, DNS_HEADER_SIZE, name) : -1;
+    if ((loc < 0) || (loc + 4 > size) || (strcmp(name, query->name) != 0) ||
+        (dnsGetWord(buffer, loc) != query->type) || (dnsGetWord(buffer, loc + 2) != query->dnsClass))
+      continue;
+
+    storeCache(query, buffer, size);
+    dnsPutWord(buffer, 0, query->clientId);
+    Udp.beginPacket(query->client, query->port);
+    Udp.write(buffer, size);
+    Udp.endPacket();
+    query->active = false;
+  }
+
+  // the client retries on its own; just free the slot
+  unsigned long currTime = millis();
+  for (byte i = 0; i < DNS_PENDING; i++) {
+    if (pending[i].active && (currTime - pending[i].sent > DNS_FORWARD_TIMEOUT)) {
+      pending[i].active = false;
+      stats.timeouts++;
+    }
+  }
+}
+
+void DNSServer::forwardCommand(OutputInterface* terminal) {
+  char buffer[20];
+  byte address[4];
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    terminal->print(INFO, "DNS Upstream: ");
+    if (forwarding())
+      terminal->println(INFO, getIPString(leases->getDNSUpstream(), buffer, sizeof(buffer)));
+    else
+      terminal->println(INFO, "Disabled");
+  } else if (strcmp(value, "off") == 0) {
+    memset(address, 0, sizeof(address));
+    leases->setDNSUpstream(address);
+    leases->setInternal(true);
+    clearCache();
+    terminal->println(PASSED, "DNS Forwarding Disabled");
+  } else if (parseIPAddress(value, address)) {
+    leases->setDNSUpstream(address);
+    leases->setInternal(true);
+    clearCache();
+    terminal->println(PASSED, "DNS Forwarding Enabled");
+  } else
+    terminal->println(ERROR, "IP Address is invalid");
+  terminal->prompt();
+}
@@ -0,0 +1,233 @@
+#include "dnsserver.h"
+
+#include "asciitable/asciitable.h"
+
+static const char arpaSuffix[] = ".in-addr.arpa";
+
+// true when name is suffix or ends with "." followed by suffix
+static bool nameUnder(const char* name, int nameLength, const char* suffix, int suffixLength) {
+  if (nameLength == suffixLength) return strcasecmp(name, suffix) == 0;
+  if (nameLength <= suffixLength) return false;
+  return (name[nameLength - suffixLength - 1] == '.') && (strcasecmp(name + nameLength - suffixLength, suffix) == 0);
+}
+
+// "d.c.b.a" from a reverse lookup name into the address a.b.c.d
+static bool parseReverse(const char* name, int length, byte* address) {
+  int octet = 3;
+  int value = -1;
+  for (int i = 0; i < length; i++) {
+    if (name[i] == '.') {
+      if ((value < 0) || (octet <= 0)) return false;
+      address[octet--] = value;
+      value = -1;
+    } else if ((name[i] >= '0') && (name[i] <= '9')) {
+      value = ((value < 0) ? 0 : value * 10) + (name[i] - '0');
+      if (value > 255) return false;
+    } else
+      return false;
+  }
+  if ((value < 0) || (octet != 0)) return false;
+  address[0] = value;
+  return true;
+}
+
+void DNSServer::addCmd(TerminalCommand* __termCmd) {
+  __termCmd->addCmd("dns", "[clear]", "Displays the queries handled by the DNS server.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { showStats(terminal); });
+  __termCmd->addCmd("forward", "[ip|off]", "Configures the resolver for names outside the domain.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { forwardCommand(terminal); });
+}
+
+void DNSServer::reservePins(BackendPinSetup* pinsetup) {
+  return;
+}
+
+bool DNSServer::setupTask(OutputInterface* __terminal) {
+  Udp.begin(DNS_PORT);
+  clearCache();
+  setRefreshMilli(10);
+  return true;
+}
+
+bool DNSServer::executeTask() {
+  for (byte i = 0; i < DNS_QUERIES_PER_TICK; i++) {
+    int packetSize = Udp.parsePacket();
+    if (packetSize <= 0) break;
+    if (packetSize > DNS_MESSAGE_SIZE) packetSize = DNS_MESSAGE_SIZE;
+    int size = Udp.read(buffer, packetSize);
+    int length = answerQuery(buffer, size);
+    if (length > 0) {
+      Udp.beginPacket(Udp.remoteIP(), Udp.remotePort());
+      Udp.write(buffer, length);
+      Udp.endPacket();
+    }
+  }
+  if (!forwarding()) closeUpstream();
+  if (upstreamPort != 0) receiveUpstream();
+  return true;
+}
+
+bool DNSServer::boundLease(byte lease, long timeMs) {
+  return leases->validLease(lease) && (leases->getLeaseStatus(lease) == DHCP_LEASE_ACK) &&
+         !leases->getLeaseExpired(lease, timeMs);
+}
+
+// Questions are never compressed, so a pointer in the name is treated as malformed
+int DNSServer::readName(const byte* message, int size, int offset, char* name) {
+  int length = 0;
+  while (offset < size) {
+    byte label = message[offset++];
+    if (label == 0) {
+      name[length] = '\0';
+      return offset;
+    }
+    if ((label & 0xC0) || (offset + label > size) || (length + label + 1 >= DNS_NAME_SIZE)) return -1;
+    if (length) name[length++] = '.';
+    for (byte i = 0; i < label; i++) name[length++] = tolower(message[offset++]);
+  }
+  return -1;
+}
+
+int DNSServer::writeName(byte* message, int offset, const char* host, const char* domain) {
+  int length = strlen(host);
+  message[offset++] = length;
+  memcpy(message + offset, host, length);
+  offset += length;
+  while (*domain) {
+    const char* dot = strchr(domain, '.');
+    length = (dot) ? dot - domain : (int) strlen(domain);
+    message[offset++] = length;
+    memcpy(message + offset, domain, length);
+    offset += length;
+    domain += length + ((dot) ? 1 : 0);
+  }
+  message[offset++] = 0;
+  return offset;
+}
+
+// Turns the query in message into its response: the question is kept, anything after it is dropped
+int DNSServer::finish(byte* message, int size, uint16_t flags, byte rcode, bool authoritative, byte answers) {
+  flags = DNS_FLAG_QR | (flags & (0x7800 | DNS_FLAG_RD)) | rcode;
+  if (authoritative) flags |= DNS_FLAG_AA;
+  if (forwarding()) flags |= DNS_FLAG_RA;
+  dnsPutWord(message, 2, flags);
+  dnsPutWord(message, 4, (size > DNS_HEADER_SIZE) ? 1 : 0);
+  dnsPutWord(message, 6, answers);
+  dnsPutWord(message, 8, 0);
+  dnsPutWord(message, 10, 0);
+  return size;
+}
+
+int DNSServer::answerQuery(byte* message, int size) {
+  if (size < DNS_HEADER_SIZE) {
+    stats.malformed++;
+    return 0;
+  }
+  uint16_t flags = dnsGetWord(message, 2);
+  if (flags & DNS_FLAG_QR) return 0; // never answer a response
+  stats.queries++;
+  if (DNS_OPCODE(flags) != 0) {
+    stats.malformed++;
+    return finish(message, DNS_HEADER_SIZE, flags, DNS_RCODE_NOTIMP, false, 0);
+  }
+
+  char name[DNS_NAME_SIZE];
+  int loc = (dnsGetWord(message, 4) == 1) ? readName(message, size, DNS_HEADER_SIZE, name) : -1;
+  if ((loc < 0) || (loc + 4 > size)) {
+    stats.malformed++;
+    return finish(message, DNS_HEADER_SIZE, flags, DNS_RCODE_FORMERR, false, 0);
+  }
+  uint16_t type = dnsGetWord(message, loc);
+  uint16_t dnsClass = dnsGetWord(message, loc + 2);
+  loc += 4;
+
+  const char* domain = leases->getDomainName();
+  int nameLength = strlen(name);
+  int domainLength = strlen(domain);
+  int arpaLength = sizeof(arpaSuffix) - 1;
+  long currTime = millis();
+  byte lease = INVALID_LEASE;
+  uint16_t answerType;
+  byte address[4];
+
+  if ((dnsClass == DNS_CLASS_IN) && nameUnder(name, nameLength, arpaSuffix + 1, arpaLength - 1) &&
+      parseReverse(name, nameLength - arpaLength, address)) {
+    // reverse lookups are ours for every served subnet
+    bool served = false;
+    for (byte subnet = LOCAL_SUBNET; subnet <= RELAY_SUBNETS; subnet++)
+      if (leases->addressInSubnet(subnet, address)) served = true;
+    if (!served) return forwardQuery(message, loc, name, type, dnsClass); // someone else's network
+    lease = leases->getLeaseByIPAddress(address);
+    if (!boundLease(lease, currTime) || (leases->getHostName(lease)[0] == '\0')) lease = INVALID_LEASE;
+    answerType = DNS_TYPE_PTR;
+  } else if ((dnsClass == DNS_CLASS_IN) && (domainLength > 0) && nameUnder(name, nameLength, domain, domainLength)) {
+    if (nameLength == domainLength) {
+      stats.noData++; // the domain itself has no address
+      return finish(message, loc, flags, DNS_RCODE_NOERROR, true, 0);
+    }
+    int hostLength = nameLength - domainLength - 1;
+    if (memchr(name, '.', hostLength) == nullptr) lease = leases->getLeaseByHostName(name, hostLength);
+    if (!boundLease(lease, currTime)) lease = INVALID_LEASE;
+    answerType = DNS_TYPE_A;
+  } else
+    return forwardQuery(message, loc, name, type, dnsClass);
+
+  if (lease == INVALID_LEASE) {
+    stats.nxDomain++;
+    return finish(message, loc, flags, DNS_RCODE_NXDOMAIN, true, 0);
+  }
+  if ((type != answerType) && (type != DNS_TYPE_ANY)) {
+    stats.noData++;
+    return finish(message, loc, flags, DNS_RCODE_NOERROR, true, 0);
+  }
+
+  const char* host = leases->getHostName(lease);
+  int rdLength = (answerType == DNS_TYPE_A) ? 4 : (int) strlen(host) + domainLength + 3;
+  if (loc + 12 + rdLength > DNS_MESSAGE_SIZE) return finish(message, loc, flags, DNS_RCODE_SERVFAIL, true, 0);
+
+  // the answer points back at the question name
+  long ttl = leases->getLeaseExpiresSec(lease, currTime);
+  if (ttl > DNS_TTL) ttl = DNS_TTL;
+  dnsPutWord(message, loc, 0xC000 | DNS_HEADER_SIZE);
+  dnsPutWord(message, loc + 2, answerType);
+  dnsPutWord(message, loc + 4, DNS_CLASS_IN);
+  dnsPutWord(message, loc + 6, ttl >> 16);
+  dnsPutWord(message, loc + 8, ttl & 0xFFFF);
+  dnsPutWord(message, loc + 10, rdLength);
+  loc += 12;
+  if (answerType == DNS_TYPE_A) {
+    leases->getLeaseIPAddress(lease, message + loc);
+    loc += 4;
+  } else
+    loc = writeName(message, loc, host, domain);
+  stats.answered++;
+  return finish(message, loc, flags, DNS_RCODE_NOERROR, true, 1);
+}
+
+void DNSServer::showStats(OutputInterface* terminal) {
+  char* value = terminal->readParameter();
+  if ((value != NULL) && (strcmp(value, "clear") == 0)) {
+    clearCache();
+    terminal->println(PASSED, "DNS Cache Cleared");
+    terminal->prompt();
+    return;
+  }
+  AsciiTable table(terminal);
+  table.addColumn(Normal, "Outcome", 20);
+  table.addColumn(Yellow, "Queries", 12);
+  table.printHeader();
+  char buffer[12];
+  auto row = [&](const char* outcome, unsigned long count) { table.printData(outcome, ultoa(count, buffer, 10)); };
+  row("Queries", stats.queries);
+  row("Answered", stats.answered);
+  row("No Data", stats.noData);
+  row("NXDOMAIN", stats.nxDomain);
+  row("Refused", stats.refused);
+  row("Malformed", stats.malformed);
+  row("Cache Hits", stats.cacheHits);
+  row("Cache Misses", stats.cacheMisses);
+  row("SERVFAIL", stats.servFail);
+  row("Upstream Timeouts", stats.timeouts);
+  table.printDone("DNS Server");
+  terminal->prompt();
+}
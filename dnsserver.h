@@ -0,0 +1,154 @@
+#ifndef __DHCP_DNS_SERVER_H
+#define __DHCP_DNS_SERVER_H
+
+#include "dhcpserver.h"
+
+#include <EthernetUdp.h>
+#include <GavelInterfaces.h>
+#include <GavelTask.h>
+
+#define DNS_PORT 53
+#define DNS_MESSAGE_SIZE 512 /* plain UDP DNS, no EDNS */
+#define DNS_HEADER_SIZE 12
+#define DNS_NAME_SIZE 256
+#define DNS_QUERIES_PER_TICK 4
+#define DNS_TTL 300 /* longest TTL handed out for a lease, in seconds */
+
+/* forwarding cache */
+#define DNS_UPSTREAM_PORT 49152    /* first of the random local ports forwarded queries leave from */
+#define DNS_UPSTREAM_PORTS 16384   /* ephemeral range, so a spoofed answer has to guess port and id */
+#define DNS_CACHE_SIZE 16
+#define DNS_CACHE_NAME 96          /* longer names are forwarded but not cached */
+#define DNS_CACHE_RESPONSE 320     /* larger responses are forwarded but not cached */
+#define DNS_CACHE_MAX_TTL 3600     /* in seconds */
+#define DNS_NEGATIVE_TTL 60        /* NXDOMAIN/NODATA without an SOA, in seconds */
+#define DNS_PENDING 8              /* queries waiting on the upstream resolver */
+#define DNS_FORWARD_TIMEOUT 2000   /* in milliseconds */
+
+/* header flags */
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_AA 0x0400
+#define DNS_FLAG_TC 0x0200
+#define DNS_FLAG_RD 0x0100
+#define DNS_FLAG_RA 0x0080
+#define DNS_OPCODE(flags) (((flags) >> 11) & 0x0F)
+
+/* record types and classes */
+#define DNS_TYPE_A 1
+#define DNS_TYPE_SOA 6
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_OPT 41
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+
+/* response codes */
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_FORMERR 1
+#define DNS_RCODE_SERVFAIL 2
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_RCODE_NOTIMP 4
+#define DNS_RCODE_REFUSED 5
+
+inline uint16_t dnsGetWord(const byte* message, int offset) {
+  return ((uint16_t) message[offset] << 8) | message[offset + 1];
+}
+
+inline void dnsPutWord(byte* message, int offset, uint16_t value) {
+  message[offset] = value >> 8;
+  message[offset + 1] = value & 0xFF;
+}
+
+/**
+ * @brief		DNS queries handled, by outcome
+ */
+struct DNSStats {
+  unsigned long queries;
+  unsigned long answered;  // A or PTR record returned
+  unsigned long noData;    // known name, no record of the requested type
+  unsigned long nxDomain;  // name under the domain or a served subnet with no lease behind it
+  unsigned long refused;   // not authoritative, and forwarding is off or recursion was not asked for
+  unsigned long malformed; // dropped or answered with FORMERR/NOTIMP
+  unsigned long cacheHits;
+  unsigned long cacheMisses; // forwarded upstream
+  unsigned long servFail;    // no room to track another forwarded query
+  unsigned long timeouts;    // the upstream resolver never answered
+};
+
+/**
+ * @brief		a response from the upstream resolver, replayed until its TTL runs out
+ */
+struct DNSCacheEntry {
+  unsigned long hash; // 0 when the entry is unused
+  uint16_t type;
+  uint16_t dnsClass;
+  unsigned long stored;   // millis() when the response arrived
+  unsigned long expires;  // millis() when it must be fetched again
+  unsigned long lastUsed; // cache clock, for LRU replacement
+  uint16_t length;
+  char name[DNS_CACHE_NAME];
+  byte response[DNS_CACHE_RESPONSE];
+};
+
+/**
+ * @brief		a query forwarded upstream, waiting for its answer
+ */
+struct DNSPending {
+  bool active;
+  uint16_t id;       // id sent upstream
+  uint16_t clientId; // id the client used
+  IPAddress client;
+  uint16_t port;
+  unsigned long sent;
+  uint16_t type;
+  uint16_t dnsClass;
+  char name[DNS_NAME_SIZE];
+};
+
+/**
+ * @brief		authoritative DNS for the leased host names
+ *
+ * Answers A queries for <host>.<domain> and PTR queries for the addresses of the served subnets from
+ * the lease table, through the host name index. Anything else is forwarded to the upstream resolver
+ * and its answer cached, or refused when no upstream is configured.
+ */
+class DNSServer : public Task {
+public:
+  DNSServer(DHCPServer* __leases) : Task("DNSServer"), leases(__leases){};
+  virtual void addCmd(TerminalCommand* __termCmd) override;
+  virtual void reservePins(BackendPinSetup* pinsetup) override;
+  virtual bool setupTask(OutputInterface* __terminal) override;
+  virtual bool executeTask() override;
+
+  void showStats(OutputInterface* terminal);
+  void forwardCommand(OutputInterface* terminal);
+  void clearCache();
+
+  DNSStats stats = {};
+
+private:
+  int answerQuery(byte* message, int size);
+  int readName(const byte* message, int size, int offset, char* name);
+  int writeName(byte* message, int offset, const char* host, const char* domain);
+  bool boundLease(byte lease, long timeMs);
+  int finish(byte* message, int size, uint16_t flags, byte rcode, bool authoritative, byte answers);
+
+  bool forwarding();
+  int forwardQuery(byte* message, int size, const char* name, uint16_t type, uint16_t dnsClass);
+  void receiveUpstream();
+  DNSCacheEntry* findCache(unsigned long hash, const char* name, uint16_t type, uint16_t dnsClass);
+  void storeCache(const DNSPending* pending, const byte* message, int size);
+  uint16_t newQueryId();
+  void rotateUpstreamPort();
+  void closeUpstream();
+
+  EthernetUDP Udp;
+  EthernetUDP upstreamUdp;
+  DNSCacheEntry cache[DNS_CACHE_SIZE];
+  DNSPending pending[DNS_PENDING];
+  unsigned long cacheClock = 0;
+  uint16_t upstreamPort = 0; // 0 while the upstream socket is closed
+  DHCPServer* leases;
+  alignas(4) byte buffer[DNS_MESSAGE_SIZE];
+};
+
+#endif // __DHCP_DNS_SERVER_H
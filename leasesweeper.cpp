@@ -0,0 +1,96 @@
+#include "leasesweeper.h"
+
+#include "asciitable/asciitable.h"
+
+void LeaseSweeper::addCmd(TerminalCommand* __termCmd) {
+  __termCmd->addCmd("sweep", "[n|off]", "Reclaims leases silent to ARP for n sweeps in a row.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { sweepCommand(terminal); });
+}
+
+void LeaseSweeper::reservePins(BackendPinSetup* pinsetup) {
+  return;
+}
+
+bool LeaseSweeper::setupTask(OutputInterface* __terminal) {
+  setRefreshMilli(100);
+  return true;
+}
+
+bool LeaseSweeper::executeTask() {
+  unsigned long currTime = millis();
+
+  // a probe that is out is always seen through, so the socket is free for the conflict probe again
+  if (probing != INVALID_LEASE) {
+    byte result = leases->arpProbe.poll();
+    if (result == ARP_PROBE_WAITING) return true;
+    leases->sweepResult(probing, result == ARP_PROBE_ANSWERED);
+    probing = INVALID_LEASE;
+  }
+  if (leases->getSweepMisses() == 0) {
+    sweeping = false;
+    return true;
+  }
+
+  if (!sweeping) {
+    if ((sweepStarted != 0) && (currTime - sweepStarted < SWEEP_PERIOD)) return true;
+    sweeping = true;
+    sweepStarted = currTime;
+    cursor = 0;
+  }
+  if ((currTime - probedAt < SWEEP_PROBE_INTERVAL) || leases->arpProbe.busy() || leases->probesWaiting()) return true;
+
+  while ((cursor < leases->leaseCount()) && !leases->sweepCandidate(cursor)) cursor++;
+  if (cursor >= leases->leaseCount()) {
+    leases->sweepStats.sweeps++;
+    sweeping = false;
+    return true;
+  }
+  byte address[4];
+  leases->getLeaseIPAddress(cursor, address);
+  if (leases->arpProbe.start(address)) {
+    probing = cursor;
+    probedAt = currTime;
+    leases->sweepStats.probes++;
+  }
+  cursor++;
+  return true;
+}
+
+void LeaseSweeper::sweepCommand(OutputInterface* terminal) {
+  char buffer[12];
+  char* value = terminal->readParameter();
+  if (value == NULL) {
+    terminal->print(INFO, "Lease Sweep: ");
+    if (leases->getSweepMisses())
+      terminal->println(INFO, String(leases->getSweepMisses()) + " silent sweeps");
+    else
+      terminal->println(INFO, "Disabled");
+
+    const SweepStats* stats = &leases->sweepStats;
+    AsciiTable table(terminal);
+    table.addColumn(Normal, "Outcome", 20);
+    table.addColumn(Yellow, "Count", 12);
+    table.printHeader();
+    auto row = [&](const char* outcome, unsigned long count) { table.printData(outcome, ultoa(count, buffer, 10)); };
+    row("Sweeps", stats->sweeps);
+    row("Probes", stats->probes);
+    row("Answered", stats->answered);
+    row("Marked", stats->marked);
+    row("Reclaimed", stats->reclaimed);
+    row("Returned", stats->returned);
+    row("Marked Now", leases->sweepMarkedCount());
+    // yield: of the leases given up on, how many went to a new client rather than back to their own
+    row("Yield (%)", (stats->marked) ? (stats->reclaimed * 100) / stats->marked : 0);
+    table.printDone("Lease Sweep");
+  } else if (strcmp(value, "off") == 0) {
+    leases->setSweepMisses(0);
+    leases->setInternal(true);
+    terminal->println(PASSED, "Lease Sweep Disabled");
+  } else if ((atoi(value) > 0) && (atoi(value) < SWEEP_MARKED)) {
+    leases->setSweepMisses(atoi(value));
+    leases->setInternal(true);
+    terminal->println(PASSED, "Lease Sweep Enabled");
+  } else
+    terminal->println(ERROR, "Parameter must be a number of sweeps or off");
+  terminal->prompt();
+}
@@ -0,0 +1,39 @@
+#ifndef __DHCP_LEASE_SWEEPER_H
+#define __DHCP_LEASE_SWEEPER_H
+
+#include "dhcpserver.h"
+
+#include <GavelInterfaces.h>
+#include <GavelTask.h>
+
+#define SWEEP_PROBE_INTERVAL 1000 /* least time between two sweep probes, in milliseconds */
+#define SWEEP_PERIOD 300000       /* least time between the starts of two sweeps, in milliseconds */
+
+/**
+ * @brief		ARP sweep of the bound leases, to find clients that left without a RELEASE
+ *
+ * Walks the lease table one address at a time, no faster than one probe per SWEEP_PROBE_INTERVAL, and
+ * starts over at most once per SWEEP_PERIOD. It shares the server's probe socket and steps aside
+ * whenever a DISCOVER is waiting on a conflict probe. A lease silent for the configured number of sweeps
+ * in a row is expired early, which makes it the first to be reclaimed when its pool runs dry.
+ */
+class LeaseSweeper : public Task {
+public:
+  LeaseSweeper(DHCPServer* __leases) : Task("LeaseSweeper"), leases(__leases){};
+  virtual void addCmd(TerminalCommand* __termCmd) override;
+  virtual void reservePins(BackendPinSetup* pinsetup) override;
+  virtual bool setupTask(OutputInterface* __terminal) override;
+  virtual bool executeTask() override;
+
+  void sweepCommand(OutputInterface* terminal);
+
+private:
+  DHCPServer* leases;
+  byte cursor = 0;              // next lease to look at in this sweep
+  byte probing = INVALID_LEASE; // lease whose probe is out
+  bool sweeping = false;
+  unsigned long sweepStarted = 0;
+  unsigned long probedAt = 0;
+};
+
+#endif // __DHCP_LEASE_SWEEPER_H
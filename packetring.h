@@ -0,0 +1,48 @@
+#ifndef __DHCP_PACKET_RING_H
+#define __DHCP_PACKET_RING_H
+
+#include "DHCPLite.h"
+
+#define PACKET_RING_SIZE 4
+
+/**
+ * @brief		one received datagram
+ */
+struct PacketSlot {
+  alignas(4) unsigned char buffer[DHCP_MESSAGE_SIZE];
+  int size;
+};
+
+/**
+ * @brief		fixed pool of packet buffers used as a FIFO ring
+ *
+ * The receive side fills slots from the head while the reply side drains them from the tail, so the
+ * W5500 can be emptied of pending datagrams before the first reply is transmitted.
+ */
+class PacketRing {
+public:
+  bool empty() const { return count == 0; }
+  bool full() const { return count == PACKET_RING_SIZE; }
+
+  // Next free slot to receive into, or nullptr when every slot is pending
+  PacketSlot* reserve() { return full() ? nullptr : &slots[head]; }
+  void commit() {
+    head = (head + 1) % PACKET_RING_SIZE;
+    count++;
+  }
+
+  // Oldest pending slot, or nullptr when nothing is waiting
+  PacketSlot* front() { return empty() ? nullptr : &slots[tail]; }
+  void pop() {
+    tail = (tail + 1) % PACKET_RING_SIZE;
+    count--;
+  }
+
+private:
+  PacketSlot slots[PACKET_RING_SIZE];
+  byte head = 0;
+  byte tail = 0;
+  byte count = 0;
+};
+
+#endif // __DHCP_PACKET_RING_H
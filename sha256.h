@@ -0,0 +1,11 @@
+#ifndef __DHCP_SHA256_H
+#define __DHCP_SHA256_H
+
+#include <Arduino.h>
+
+#define SHA256_SIZE 32
+
+// SHA-256 (FIPS 180-4) of one buffer, for the DHCID records of RFC 4701
+void sha256(const byte* data, int length, byte* digest);
+
+#endif // __DHCP_SHA256_H
@@ -0,0 +1,280 @@
+// Host test for DHCPEngine: two engines, each over its own lease store, answer the same client
+// without touching each other's bindings.
+//
+// Build and run with "make -C test".
+
+#include "DHCPLite.h"
+#include "dhcpleasestore.h"
+
+static unsigned long now = 1000;
+unsigned long millis() {
+  return now;
+}
+
+#define FAKE_LEASES 8
+#define FAKE_START 100
+
+/**
+ * @brief		a single local subnet with a handful of leases and nothing else configured
+ */
+class FakeLeaseStore : public DHCPLeaseStore {
+public:
+  FakeLeaseStore(const byte* __network) {
+    memcpy(network, __network, 4);
+    memset(macs, 0, sizeof(macs));
+    memset(clientIds, 0, sizeof(clientIds));
+    memset(status, 0, sizeof(status));
+    memset(expires, 0, sizeof(expires));
+  };
+
+  byte getSubnetForRelay(const byte* giaddr) override { return (zeroAddress(giaddr)) ? LOCAL_SUBNET : INVALID_SUBNET; }
+  byte getLeaseSubnet(byte lease) override { return LOCAL_SUBNET; }
+  bool addressInSubnet(byte subnet, const byte* address) override { return memcmp(address, network, 3) == 0; }
+  byte selectPool(byte subnet, const byte* __macAddress, const byte* vendorClass, int vendorLength) override {
+    return subnet;
+  }
+  byte getLeasePool(byte lease) override { return (validLeaseNumber(lease)) ? LOCAL_SUBNET : INVALID_POOL; }
+  unsigned long getPoolLeaseTime(byte pool) override { return 3600; }
+  void getPoolConfig(byte pool, SubnetConfig* config) override {
+    memset(config, 0, sizeof(SubnetConfig));
+    memcpy(config->network, network, 4);
+    memset(config->subnetMask, 255, 3);
+    memcpy(config->router, network, 4);
+    config->router[3] = 1;
+    memcpy(config->dns, config->router, 4);
+  }
+  bool getPoolBoot(byte pool, BootConfig* boot) override { return false; }
+  void getPoolProfile(byte pool, ClassProfile* profile) override { memset(profile, 0, sizeof(ClassProfile)); }
+  bool getRapidCommit() override { return false; }
+  bool ddnsEnabled() override { return false; }
+
+  const byte* getReservedAddress(const byte* __macAddress) override { return nullptr; }
+  byte getPortByAgentInfo(const byte* agentInfo, int length) override { return INVALID_PORT; }
+  byte getPortPool(byte port, byte subnet, byte pool) override { return pool; }
+  const byte* getPortAddress(byte port) override { return nullptr; }
+  bool queryRequesterTrusted(const byte* giaddr) override { return false; }
+
+  unsigned long clientIdHash(const byte* clientId, int length) override { return fnv1a(clientId, length); }
+  byte getLease(byte* __macAddress, unsigned long clientId) override {
+    byte lease = getLeaseByClientId(clientId);
+    return (lease != INVALID_LEASE) ? lease : getLeaseByMAC(__macAddress);
+  }
+  byte getLeaseByClientId(unsigned long clientId) override {
+    for (byte i = 0; (clientId != 0) && (i < FAKE_LEASES); i++)
+      if (clientIds[i] == clientId) return i;
+    return INVALID_LEASE;
+  }
+  byte getLeaseByMAC(const byte* __macAddress) override {
+    for (byte i = 0; i < FAKE_LEASES; i++)
+      if (validLease(i) && (memcmp(macs[i], __macAddress, 6) == 0)) return i;
+    return INVALID_LEASE;
+  }
+  byte getLeaseByIPAddress(const byte* __ipAddress) override {
+    if (!addressInSubnet(LOCAL_SUBNET, __ipAddress)) return INVALID_LEASE;
+    byte lease = __ipAddress[3] - FAKE_START;
+    return (validLeaseNumber(lease)) ? lease : INVALID_LEASE;
+  }
+  byte getNewLease(byte pool, const byte* __macAddress) override {
+    for (byte i = 0; i < FAKE_LEASES; i++)
+      if (leaseAvailable(i)) return i;
+    return INVALID_LEASE;
+  }
+  bool validLease(byte lease) override {
+    static const byte blank[6] = {0};
+    return validLeaseNumber(lease) && (memcmp(macs[lease], blank, 6) != 0);
+  }
+  bool validLeaseNumber(byte lease) override { return lease < FAKE_LEASES; }
+  bool leaseAvailable(byte lease) override { return validLeaseNumber(lease) && !validLease(lease); }
+
+  void setLease(byte lease, byte* __macAddress, long __expires, byte __status, unsigned long clientId) override {
+    if (!validLeaseNumber(lease)) return;
+    memcpy(macs[lease], __macAddress, 6);
+    expires[lease] = __expires;
+    status[lease] = __status;
+    clientIds[lease] = clientId;
+  }
+  void deleteLease(byte lease) override {
+    if (!validLeaseNumber(lease)) return;
+    memset(macs[lease], 0, 6);
+    expires[lease] = 0;
+    status[lease] = DHCP_LEASE_AVAIL;
+    clientIds[lease] = 0;
+  }
+  void releaseLease(byte lease) override { deleteLease(lease); }
+  void declineLease(byte lease, unsigned long least) override { deleteLease(lease); }
+  bool probeWanted(byte subnet) override { return false; }
+  bool probingLease(byte lease) override { return false; }
+  bool setHostName(byte lease, const char* name, int length, bool publish) override { return false; }
+  const char* getHostName(byte lease) override { return ""; }
+
+  byte* getLeaseMACAddress(byte lease) override { return macs[lease]; }
+  bool getLeaseIPAddress(byte lease, byte* ipAddress) override {
+    if (!validLeaseNumber(lease)) return false;
+    memcpy(ipAddress, network, 3);
+    ipAddress[3] = FAKE_START + lease;
+    return true;
+  }
+  byte getLeaseStatus(byte lease) override { return status[lease]; }
+  bool getLeaseExpired(byte lease, long timeMs) override { return (timeMs - expires[lease]) > 0; }
+  long getLeaseExpiresSec(byte lease, long timeMs) override { return (expires[lease] - timeMs) / 1000; }
+
+  DropStats* getDropStats() override { return &dropStats; }
+
+  DropStats dropStats = {};
+
+private:
+  byte network[4];
+  byte macs[FAKE_LEASES][6];
+  unsigned long clientIds[FAKE_LEASES];
+  byte status[FAKE_LEASES];
+  long expires[FAKE_LEASES];
+};
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                                     \
+  do {                                                                                                       \
+    if (!(condition)) {                                                                                      \
+      printf("%s:%d: FAILED: %s\n", __FILE__, __LINE__, #condition);                                       \
+      failures++;                                                                                            \
+    }                                                                                                        \
+  } while (0)
+
+// A client message with the given type; REQUESTs name the offered address and the server that made it
+static int buildRequest(byte* buffer, const byte* mac, byte type, const byte* requested, const byte* server) {
+  memset(buffer, 0, DHCP_MESSAGE_SIZE);
+  RIP_MSG* packet = (RIP_MSG*) buffer;
+  packet->op = DHCP_BOOTREQUEST;
+  packet->htype = DHCP_HTYPE_ETHERNET;
+  packet->hlen = DHCP_HLEN_ETHERNET;
+  packet->xid = 0x12345678;
+  memcpy(packet->chaddr, mac, 6);
+  const byte magic[4] = {0x63, 0x82, 0x53, 0x63};
+  memcpy(packet->magic, magic, 4);
+
+  int loc = 0;
+  packet->OPT[loc++] = dhcpMessageType;
+  packet->OPT[loc++] = 1;
+  packet->OPT[loc++] = type;
+  packet->OPT[loc++] = dhcpParamRequest;
+  packet->OPT[loc++] = 3;
+  packet->OPT[loc++] = dhcpSubnetMask;
+  packet->OPT[loc++] = dhcpRoutersOnSubnet;
+  packet->OPT[loc++] = dhcpDns;
+  if (requested) {
+    packet->OPT[loc++] = dhcpRequestedIPaddr;
+    packet->OPT[loc++] = 4;
+    memcpy(packet->OPT + loc, requested, 4);
+    loc += 4;
+  }
+  if (server) {
+    packet->OPT[loc++] = dhcpServerIdentifier;
+    packet->OPT[loc++] = 4;
+    memcpy(packet->OPT + loc, server, 4);
+    loc += 4;
+  }
+  packet->OPT[loc++] = dhcpEndOption;
+  return DHCP_OPTIONS_OFFSET + loc;
+}
+
+// Runs one message through the engine and flattens the gather list it answers with
+static int exchange(DHCPEngine* engine, byte* request, int size, byte* answer) {
+  DHCPReply reply;
+  if (engine->DHCPreply((RIP_MSG*) request, size, &reply) == 0) return 0;
+  int length = 0;
+  for (byte i = 0; i < reply.segments; i++) {
+    memcpy(answer + length, reply.segment[i].data, reply.segment[i].length);
+    length += reply.segment[i].length;
+  }
+  return length;
+}
+
+// Value of an option in a flattened reply, or nullptr
+static const byte* findOption(const byte* answer, int length, byte code) {
+  int i = DHCP_OPTIONS_OFFSET;
+  while ((i + 1 < length) && (answer[i] != dhcpEndOption)) {
+    if (answer[i] == dhcpPadOption) {
+      i++;
+      continue;
+    }
+    if (answer[i] == code) return answer + i + 2;
+    i += 2 + answer[i + 1];
+  }
+  return nullptr;
+}
+
+// DISCOVER then REQUEST against one engine; returns the address bound
+static void bind(DHCPEngine* engine, FakeLeaseStore* store, const byte* mac, const byte* serverIP, byte* bound) {
+  byte request[DHCP_MESSAGE_SIZE];
+  byte answer[DHCP_MESSAGE_SIZE];
+
+  int length = exchange(engine, request, buildRequest(request, mac, DHCP_DISCOVER, nullptr, nullptr), answer);
+  CHECK(length > 0);
+  const byte* type = findOption(answer, length, dhcpMessageType);
+  CHECK(type && (*type == DHCP_OFFER));
+  const byte* server = findOption(answer, length, dhcpServerIdentifier);
+  CHECK(server && (memcmp(server, serverIP, 4) == 0));
+  byte offered[4];
+  memcpy(offered, ((RIP_MSG*) answer)->yiaddr, 4);
+
+  length = exchange(engine, request, buildRequest(request, mac, DHCP_REQUEST, offered, serverIP), answer);
+  CHECK(length > 0);
+  type = findOption(answer, length, dhcpMessageType);
+  CHECK(type && (*type == DHCP_ACK));
+  CHECK(memcmp(((RIP_MSG*) answer)->yiaddr, offered, 4) == 0);
+  memcpy(bound, offered, 4);
+}
+
+int main() {
+  const byte networkA[4] = {192, 168, 1, 0};
+  const byte networkB[4] = {10, 0, 0, 0};
+  const byte serverA[4] = {192, 168, 1, 2};
+  const byte serverB[4] = {10, 0, 0, 2};
+  const byte mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+  const byte other[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+
+  FakeLeaseStore storeA(networkA);
+  FakeLeaseStore storeB(networkB);
+  DHCPEngineConfig configA;
+  configA.serverIP = serverA;
+  configA.domainName = "a.test";
+  DHCPEngineConfig configB;
+  configB.serverIP = serverB;
+  configB.domainName = "b.test";
+  DHCPEngine engineA(&storeA, &configA);
+  DHCPEngine engineB(&storeB, &configB);
+
+  // the same client is bound by both servers, each from its own network
+  byte boundA[4];
+  byte boundB[4];
+  bind(&engineA, &storeA, mac, serverA, boundA);
+  bind(&engineB, &storeB, mac, serverB, boundB);
+  CHECK(memcmp(boundA, networkA, 3) == 0);
+  CHECK(memcmp(boundB, networkB, 3) == 0);
+  CHECK(storeA.getLeaseByMAC(mac) == 0);
+  CHECK(storeB.getLeaseByMAC(mac) == 0);
+
+  // a second client on A only takes the next address there and leaves B alone
+  byte second[4];
+  bind(&engineA, &storeA, other, serverA, second);
+  CHECK(second[3] == boundA[3] + 1);
+  CHECK(storeA.getLeaseByMAC(other) == 1);
+  CHECK(storeB.getLeaseByMAC(other) == INVALID_LEASE);
+  CHECK(!storeB.validLease(1));
+
+  // releasing on B frees B's binding and keeps A's
+  byte request[DHCP_MESSAGE_SIZE];
+  byte answer[DHCP_MESSAGE_SIZE];
+  int size = buildRequest(request, mac, DHCP_RELEASE, nullptr, serverB);
+  memcpy(((RIP_MSG*) request)->ciaddr, boundB, 4);
+  CHECK(exchange(&engineB, request, size, answer) == 0);
+  CHECK(storeB.getLeaseByMAC(mac) == INVALID_LEASE);
+  CHECK(storeA.getLeaseByMAC(mac) == 0);
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("engine test passed\n");
+  return 0;
+}
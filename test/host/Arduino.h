@@ -0,0 +1,16 @@
+// Just enough of the Arduino core to build the DHCP engine on the host
+
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+typedef uint8_t byte;
+
+unsigned long millis();
+
+#endif // __HOST_ARDUINO_H
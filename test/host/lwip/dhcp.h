@@ -0,0 +1 @@
+// htons and ntohs come from <arpa/inet.h> on the host
@@ -0,0 +1,267 @@
+#include "tftpserver.h"
+
+#include "asciitable/asciitable.h"
+
+static void putWord(byte* packet, int offset, uint16_t value) {
+  packet[offset] = value >> 8;
+  packet[offset + 1] = value & 0xFF;
+}
+
+static uint16_t getWord(const byte* packet, int offset) {
+  return ((uint16_t) packet[offset] << 8) | packet[offset + 1];
+}
+
+void TFTPServer::addCmd(TerminalCommand* __termCmd) {
+  __termCmd->addCmd("tftp", "", "Displays the transfers handled by the TFTP server.",
+                    [this](TerminalLibrary::OutputInterface* terminal) { showStats(terminal); });
+}
+
+void TFTPServer::reservePins(BackendPinSetup* pinsetup) {
+  return;
+}
+
+bool TFTPServer::setupTask(OutputInterface* __terminal) {
+  mounted = LittleFS.begin();
+  if (!mounted) __terminal->println(ERROR, "TFTP Server: LittleFS mount failed, boot images unavailable");
+  setRefreshMilli(10);
+  return true;
+}
+
+bool TFTPServer::executeTask() {
+  // port 69 holds a W5500 socket, so it is opened only while a range boots from here; a transfer under way
+  // is finished first
+  bool wanted = mounted && leases->localBootWanted();
+  bool busy = false;
+  for (byte i = 0; i < TFTP_SESSIONS; i++)
+    if (sessions[i].active) busy = true;
+  if (wanted && !listening)
+    listening = Udp.begin(TFTP_PORT);
+  else if (!wanted && listening && !busy) {
+    Udp.stop();
+    listening = false;
+  }
+  if (!listening) return true;
+
+  for (byte i = 0; i < TFTP_PACKETS_PER_TICK; i++) {
+    int packetSize = Udp.parsePacket();
+    if (packetSize <= 0) break;
+    if (packetSize >= (int) sizeof(buffer)) packetSize = sizeof(buffer) - 1;
+    int size = Udp.read(buffer, packetSize);
+    if (size < 4) continue;
+    buffer[size] = 0; // request strings always end inside the buffer
+
+    IPAddress client = Udp.remoteIP();
+    uint16_t port = Udp.remotePort();
+    TFTPSession* session = findSession(client, port);
+    switch (getWord(buffer, 0)) {
+    case TFTP_RRQ: handleRequest(size); break;
+    case TFTP_WRQ:
+      stats.refused++;
+      sendError(client, port, TFTP_ERROR_ACCESS, "Read only server");
+      break;
+    case TFTP_ACK:
+      if (session)
+        handleAck(session, getWord(buffer, 2));
+      else
+        sendError(client, port, TFTP_ERROR_UNKNOWN_TID, "Unknown transfer ID");
+      break;
+    case TFTP_ERROR:
+      if (session) closeSession(session); // the client gave up
+      break;
+    default: sendError(client, port, TFTP_ERROR_ILLEGAL, "Illegal operation"); break;
+    }
+  }
+
+  // nothing heard back: send the window again, and give up on a client that has gone quiet
+  unsigned long currTime = millis();
+  for (byte i = 0; i < TFTP_SESSIONS; i++) {
+    TFTPSession* session = &sessions[i];
+    if (!session->active || (currTime - session->sentAt < TFTP_TIMEOUT)) continue;
+    if (++session->retries > TFTP_RETRIES) {
+      stats.timeouts++;
+      closeSession(session);
+      continue;
+    }
+    stats.retransmits++;
+    if (session->oack)
+      sendOptions(session);
+    else
+      sendWindow(session);
+  }
+  return true;
+}
+
+TFTPSession* TFTPServer::findSession(IPAddress client, uint16_t port) {
+  for (byte i = 0; i < TFTP_SESSIONS; i++)
+    if (sessions[i].active && (sessions[i].client == client) && (sessions[i].port == port)) return &sessions[i];
+  return nullptr;
+}
+
+void TFTPServer::closeSession(TFTPSession* session) {
+  session->file.close();
+  session->active = false;
+}
+
+void TFTPServer::handleRequest(int size) {
+  IPAddress client = Udp.remoteIP();
+  uint16_t port = Udp.remotePort();
+  stats.requests++;
+
+  // file name, mode, then option name/value pairs
+  const char* fields[16];
+  int count = 0;
+  for (int loc = 2; (loc < size) && (count < 16); loc += strlen((const char*) buffer + loc) + 1)
+    fields[count++] = (const char*) buffer + loc;
+  if (count < 2) {
+    sendError(client, port, TFTP_ERROR_ILLEGAL, "Malformed request");
+    return;
+  }
+  const char* name = fields[0];
+  while (*name == '/') name++;
+  if ((*name == '\0') || strstr(name, "..") || (strlen(TFTP_ROOT) + strlen(name) >= TFTP_PATH_SIZE)) {
+    stats.refused++;
+    sendError(client, port, TFTP_ERROR_ACCESS, "Bad file name");
+    return;
+  }
+  if (strcasecmp(fields[1], "octet") != 0) { // boot images are binary; netascii would need line conversion
+    sendError(client, port, TFTP_ERROR_ILLEGAL, "Unsupported mode");
+    return;
+  }
+
+  // a repeated request restarts the transfer
+  TFTPSession* session = findSession(client, port);
+  if (session) closeSession(session);
+  for (byte i = 0; (session == nullptr) && (i < TFTP_SESSIONS); i++)
+    if (!sessions[i].active) session = &sessions[i];
+  if (session == nullptr) {
+    stats.refused++;
+    sendError(client, port, TFTP_ERROR_UNDEFINED, "Server busy");
+    return;
+  }
+
+  char path[TFTP_PATH_SIZE];
+  snprintf(path, sizeof(path), "%s%s", TFTP_ROOT, name);
+  session->file = LittleFS.open(path, "r");
+  if (!session->file || session->file.isDirectory()) {
+    if (session->file) session->file.close();
+    stats.notFound++;
+    sendError(client, port, TFTP_ERROR_NOT_FOUND, "File not found");
+    return;
+  }
+
+  session->active = true;
+  session->client = client;
+  session->port = port;
+  session->size = session->file.size();
+  session->blockSize = TFTP_BLOCK_SIZE;
+  session->windowSize = 1;
+  session->options = 0;
+  for (int i = 2; i + 1 < count; i += 2) {
+    long value = atol(fields[i + 1]);
+    if ((strcasecmp(fields[i], "blksize") == 0) && (value >= 8)) {
+      session->blockSize = (value > TFTP_BLOCK_MAX) ? TFTP_BLOCK_MAX : value;
+      session->options |= TFTP_OPTION_BLKSIZE;
+    } else if ((strcasecmp(fields[i], "windowsize") == 0) && (value >= 1)) {
+      session->windowSize = (value > TFTP_WINDOW_MAX) ? TFTP_WINDOW_MAX : value;
+      session->options |= TFTP_OPTION_WINDOWSIZE;
+    } else if (strcasecmp(fields[i], "tsize") == 0)
+      session->options |= TFTP_OPTION_TSIZE;
+  }
+  session->last = session->size / session->blockSize + 1;
+  session->acked = 0;
+  session->sent = 0;
+  session->retries = 0;
+  session->oack = (session->options != 0);
+  if (session->oack)
+    sendOptions(session);
+  else
+    sendWindow(session);
+}
+
+// A duplicate ACK is left to the timeout, so a delayed ACK never doubles the traffic (RFC 1123 4.2.3.1)
+void TFTPServer::handleAck(TFTPSession* session, uint16_t block) {
+  if (session->oack) {
+    if (block != 0) return;
+    session->oack = false;
+  } else {
+    unsigned long acked = (session->acked & ~0xFFFFUL) | block;
+    if (acked < session->acked) acked += 0x10000;
+    if ((acked <= session->acked) || (acked > session->sent)) return;
+    session->acked = acked;
+    if (acked >= session->last) {
+      stats.completed++;
+      closeSession(session);
+      return;
+    }
+  }
+  session->retries = 0;
+  sendWindow(session);
+}
+
+void TFTPServer::sendOptions(TFTPSession* session) {
+  int loc = 0;
+  putWord(buffer, loc, TFTP_OACK);
+  loc += 2;
+  auto add = [&](const char* name, unsigned long value) {
+    loc += snprintf((char*) buffer + loc, sizeof(buffer) - loc, "%s", name) + 1;
+    loc += snprintf((char*) buffer + loc, sizeof(buffer) - loc, "%lu", value) + 1;
+  };
+  if (session->options & TFTP_OPTION_BLKSIZE) add("blksize", session->blockSize);
+  if (session->options & TFTP_OPTION_WINDOWSIZE) add("windowsize", session->windowSize);
+  if (session->options & TFTP_OPTION_TSIZE) add("tsize", session->size);
+  Udp.beginPacket(session->client, session->port);
+  Udp.write(buffer, loc);
+  Udp.endPacket();
+  session->sentAt = millis();
+}
+
+// Sends every block of the window after the last acknowledged one, reading each straight from flash
+void TFTPServer::sendWindow(TFTPSession* session) {
+  unsigned long end = session->acked + session->windowSize;
+  if (end > session->last) end = session->last;
+  for (unsigned long block = session->acked + 1; block <= end; block++) {
+    int length = 0;
+    if (session->file.seek((block - 1) * session->blockSize))
+      length = session->file.read(buffer + 4, session->blockSize);
+    if (length < 0) length = 0;
+    putWord(buffer, 0, TFTP_DATA);
+    putWord(buffer, 2, block & 0xFFFF);
+    Udp.beginPacket(session->client, session->port);
+    Udp.write(buffer, 4 + length);
+    Udp.endPacket();
+    stats.blocks++;
+  }
+  session->sent = end;
+  session->sentAt = millis();
+}
+
+void TFTPServer::sendError(IPAddress client, uint16_t port, uint16_t code, const char* message) {
+  putWord(buffer, 0, TFTP_ERROR);
+  putWord(buffer, 2, code);
+  int length = snprintf((char*) buffer + 4, sizeof(buffer) - 4, "%s", message) + 1;
+  Udp.beginPacket(client, port);
+  Udp.write(buffer, 4 + length);
+  Udp.endPacket();
+}
+
+void TFTPServer::showStats(OutputInterface* terminal) {
+  AsciiTable table(terminal);
+  table.addColumn(Normal, "Outcome", 20);
+  table.addColumn(Yellow, "Count", 12);
+  table.printHeader();
+  char text[12];
+  byte active = 0;
+  for (byte i = 0; i < TFTP_SESSIONS; i++)
+    if (sessions[i].active) active++;
+  auto row = [&](const char* outcome, unsigned long count) { table.printData(outcome, ultoa(count, text, 10)); };
+  row("Requests", stats.requests);
+  row("Completed", stats.completed);
+  row("Not Found", stats.notFound);
+  row("Refused", stats.refused);
+  row("Timed Out", stats.timeouts);
+  row("Blocks Sent", stats.blocks);
+  row("Retransmits", stats.retransmits);
+  row("Active", active);
+  table.printDone("TFTP Server");
+  terminal->prompt();
+}
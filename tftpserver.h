@@ -0,0 +1,112 @@
+#ifndef __DHCP_TFTP_SERVER_H
+#define __DHCP_TFTP_SERVER_H
+
+#include "dhcpserver.h"
+
+#include <EthernetUdp.h>
+#include <GavelInterfaces.h>
+#include <GavelTask.h>
+#include <LittleFS.h>
+
+#define TFTP_PORT 69
+#define TFTP_ROOT "/tftp/"     /* boot images live under this flash directory */
+#define TFTP_PATH_SIZE 96
+#define TFTP_SESSIONS 2
+#define TFTP_BLOCK_SIZE 512    /* RFC 1350 block size when the client does not negotiate */
+#define TFTP_BLOCK_MAX 1428    /* largest block that fits an Ethernet frame */
+#define TFTP_WINDOW_MAX 16     /* RFC 7440 blocks sent per acknowledgement */
+#define TFTP_TIMEOUT 1000      /* in milliseconds */
+#define TFTP_RETRIES 5
+#define TFTP_PACKETS_PER_TICK 8
+
+/* opcodes */
+#define TFTP_RRQ 1
+#define TFTP_WRQ 2
+#define TFTP_DATA 3
+#define TFTP_ACK 4
+#define TFTP_ERROR 5
+#define TFTP_OACK 6
+
+/* error codes */
+#define TFTP_ERROR_UNDEFINED 0
+#define TFTP_ERROR_NOT_FOUND 1
+#define TFTP_ERROR_ACCESS 2
+#define TFTP_ERROR_ILLEGAL 4
+#define TFTP_ERROR_UNKNOWN_TID 5
+
+/* negotiated options, for the OACK */
+#define TFTP_OPTION_BLKSIZE 0x01
+#define TFTP_OPTION_WINDOWSIZE 0x02
+#define TFTP_OPTION_TSIZE 0x04
+
+/**
+ * @brief		TFTP transfers, by outcome
+ */
+struct TFTPStats {
+  unsigned long requests;
+  unsigned long completed;
+  unsigned long notFound;
+  unsigned long refused;     // write requests, bad names and no free session
+  unsigned long timeouts;    // client stopped acknowledging
+  unsigned long blocks;      // DATA packets sent, including retransmissions
+  unsigned long retransmits; // windows sent again after a timeout
+};
+
+/**
+ * @brief		one read transfer
+ */
+struct TFTPSession {
+  bool active;
+  IPAddress client;
+  uint16_t port;
+  File file;
+  unsigned long size;
+  uint16_t blockSize;
+  uint16_t windowSize;
+  byte options;          // TFTP_OPTION_* acknowledged in the OACK
+  bool oack;             // waiting for the ACK of the OACK
+  unsigned long acked;   // highest block acknowledged, counted past the 16 bit wrap
+  unsigned long sent;    // highest block sent
+  unsigned long last;    // final block, shorter than blockSize (possibly empty)
+  unsigned long sentAt;
+  byte retries;
+};
+
+/**
+ * @brief		read-only TFTP server for network boot images
+ *
+ * Files are streamed a block at a time from flash, so an image never has to fit in RAM. Clients may
+ * negotiate blksize (RFC 2348), tsize (RFC 2349) and windowsize (RFC 7440). All transfers are served
+ * from the port 69 socket and told apart by client address and port, which keeps the W5500 sockets
+ * free for everything else. The socket is only open while some range boots from this server.
+ */
+class TFTPServer : public Task {
+public:
+  TFTPServer(DHCPServer* __leases) : Task("TFTPServer"), leases(__leases){};
+  virtual void addCmd(TerminalCommand* __termCmd) override;
+  virtual void reservePins(BackendPinSetup* pinsetup) override;
+  virtual bool setupTask(OutputInterface* __terminal) override;
+  virtual bool executeTask() override;
+
+  void showStats(OutputInterface* terminal);
+
+  TFTPStats stats = {};
+
+private:
+  void handleRequest(int size);
+  void handleAck(TFTPSession* session, uint16_t block);
+  void sendOptions(TFTPSession* session);
+  void sendWindow(TFTPSession* session);
+  void sendError(IPAddress client, uint16_t port, uint16_t code, const char* message);
+  TFTPSession* findSession(IPAddress client, uint16_t port);
+  void closeSession(TFTPSession* session);
+
+  DHCPServer* leases;
+  EthernetUDP Udp;
+  bool mounted = false;
+  bool listening = false;
+  TFTPSession sessions[TFTP_SESSIONS];
+  alignas(4) byte buffer[TFTP_BLOCK_MAX + 4];
+};
+
+#endif // __DHCP_TFTP_SERVER_H